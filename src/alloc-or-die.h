@@ -6,10 +6,29 @@
 #define ALLOC_OR_DIE_H 1
 
 #include <stddef.h>		/* size_t */
+#include <stdint.h>		/* uint64_t */
 #include <stdlib.h>		/* malloc, calloc */
 
 #include <logerr-die.h>
 
+/*
+ Built with -DALLOC_OR_DIE_COUNTING each successful allocation by these
+ macros is counted, and alloc_or_die_counts reports the totals; frees
+ are not seen, so the bytes are those ever allocated, not those live.
+ Without it the hook compiles away.
+*/
+#ifndef alloc_or_die_count
+#ifdef ALLOC_OR_DIE_COUNTING
+void alloc_or_die_count_bytes(size_t size);
+#define alloc_or_die_count(size) alloc_or_die_count_bytes(size)
+#else
+#define alloc_or_die_count(size) do { (void)(size); } while (0)
+#endif
+#endif
+
+/* returns 0 if counting was not built in */
+int alloc_or_die_counts(uint64_t *allocations, uint64_t *bytes);
+
 #ifndef calloc_or_die
 #define calloc_or_die(pptr, n_members, size_each) \
 	do { \
@@ -21,6 +40,7 @@
 			die("could not calloc(%zu, %zu) (%zu bytes) for %s?", \
 				_codie_nmeb, _codie_size, _codie_tot, #pptr); \
 		} \
+		alloc_or_die_count(_codie_nmeb * _codie_size); \
 	} while (0)
 #endif
 
@@ -33,6 +53,7 @@
 			die("could not allocate %zu bytes for %s?", \
 				_modie_size, #pptr); \
 		} \
+		alloc_or_die_count(_modie_size); \
 	} while (0)
 #endif
 
@@ -44,6 +65,8 @@
 		if (!_modie_ptr) { \
 			logerror("could not allocate %zu bytes for %s?", \
 				_modie_size, #pptr); \
+		} else { \
+			alloc_or_die_count(_modie_size); \
 		} \
 	} while (0)
 #endif
@@ -8,6 +8,7 @@
 
 #include <logerr-die.h>
 #include <alloc-or-die.h>
+#include <trace-events.h>
 
 #include <basic-thread-pool.h>
 
@@ -56,6 +57,7 @@ struct basic_thread_pool {
 	thrd_t *threads;
 	basic_thread_pool_loop_context_s *thread_contexts;
 	size_t threads_len;
+	size_t num_running;
 	size_t num_working;
 	basic_thread_pool_todo_s *first;
 	basic_thread_pool_todo_s *last;
@@ -74,6 +76,7 @@ static int basic_thread_pool_loop(void *arg)
 			Tc(cnd_wait(pool->todo, pool->mutex), id);
 		}
 		if (pool->stop) {
+			--(pool->num_running);
 			Tc(cnd_broadcast(pool->done), id);
 			Tc(mtx_unlock(pool->mutex), id);
 			break;
@@ -89,7 +92,9 @@ static int basic_thread_pool_loop(void *arg)
 				void *arg = elem->arg;
 				thrd_start_t func = elem->func;
 				free(elem);
+				trace_event_begin("pool_task");
 				func(arg);
+				trace_event_end("pool_task");
 			}
 
 			Tc(mtx_lock(pool->mutex), id);
@@ -144,6 +149,7 @@ basic_thread_pool_s *basic_thread_pool_new(size_t num_threads)
 	malloc_or_log(&pool->thread_contexts, size);
 
 	pool->threads_len = num_threads;
+	pool->num_running = num_threads;
 	for (size_t i = 0; i < pool->threads_len; ++i) {
 		id = 1 + i;
 		pool->thread_contexts[i].pool = pool;
@@ -155,6 +161,7 @@ basic_thread_pool_s *basic_thread_pool_new(size_t num_threads)
 		Tc((err = thrd_create(thread, func, arg)), id);
 		if (err) {
 			logerror("could not (%s)\n", "pool->done");
+			--(pool->num_running);
 		}
 #ifndef DEBUG
 		Tc(thrd_detach(*thread), id);
@@ -197,6 +204,38 @@ int basic_thread_pool_add(basic_thread_pool_s *pool, thrd_start_t func,
 	return (err1 || err2 || err3) ? 1 : 0;
 }
 
+int basic_thread_pool_help(basic_thread_pool_s *pool)
+{
+	size_t id = 0;
+	assert(pool);
+
+	Tc(mtx_lock(pool->mutex), id);
+	basic_thread_pool_todo_s *elem = pool->first;
+	if (elem != NULL) {
+		pool->first = elem->next;
+		++(pool->num_working);
+	}
+	Tc(mtx_unlock(pool->mutex), id);
+
+	if (elem == NULL) {
+		return 0;
+	}
+
+	void *arg = elem->arg;
+	thrd_start_t func = elem->func;
+	free(elem);
+	trace_event_begin("pool_task_helped");
+	func(arg);
+	trace_event_end("pool_task_helped");
+
+	Tc(mtx_lock(pool->mutex), id);
+	--(pool->num_working);
+	Tc(cnd_broadcast(pool->done), id);
+	Tc(mtx_unlock(pool->mutex), id);
+
+	return 1;
+}
+
 int basic_thread_pool_wait(basic_thread_pool_s *pool)
 {
 	size_t id = 0;
@@ -222,6 +261,23 @@ size_t basic_thread_pool_size(basic_thread_pool_s *pool)
 	return pool->threads_len;
 }
 
+size_t basic_thread_pool_memory_usage(basic_thread_pool_s *pool)
+{
+	size_t id = 0;
+	assert(pool);
+	size_t size = sizeof(basic_thread_pool_s) + sizeof(mtx_t) +
+	    (2 * sizeof(cnd_t)) +
+	    (pool->threads_len *
+	     (sizeof(thrd_t) + sizeof(basic_thread_pool_loop_context_s)));
+	Tc(mtx_lock(pool->mutex), id);
+	for (basic_thread_pool_todo_s *elem = pool->first; elem;
+	     elem = elem->next) {
+		size += sizeof(basic_thread_pool_todo_s);
+	}
+	Tc(mtx_unlock(pool->mutex), id);
+	return size;
+}
+
 void basic_thread_pool_stop_and_free(basic_thread_pool_s **pool_ref)
 {
 	basic_thread_pool_s *pool = *pool_ref;
@@ -241,8 +297,9 @@ void basic_thread_pool_stop_and_free(basic_thread_pool_s **pool_ref)
 	Tc(cnd_broadcast(pool->todo), id);
 	Tc(mtx_unlock(pool->mutex), id);
 
+	/* idle threads must leave the loop before the mutex is destroyed */
 	Tc(mtx_lock(pool->mutex), id);
-	while (pool->num_working > 0) {
+	while (pool->num_working > 0 || pool->num_running > 0) {
 		Tc(cnd_broadcast(pool->todo), id);
 		Tc(cnd_wait(pool->done, pool->mutex), id);
 	}
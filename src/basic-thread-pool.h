@@ -15,10 +15,20 @@ basic_thread_pool_s *basic_thread_pool_new(size_t num_threads);
 int basic_thread_pool_add(basic_thread_pool_s *pool, thrd_start_t func,
 			  void *arg);
 
+/* runs one queued task, if any, on the calling thread; returns the
+   number of tasks run. Lets a thread waiting on its own tasks work
+   rather than block, even when it is itself one of the pool threads */
+int basic_thread_pool_help(basic_thread_pool_s *pool);
+
+/* waits until the queue is empty and no task is running, including
+   tasks added by other callers sharing the pool */
 int basic_thread_pool_wait(basic_thread_pool_s *pool);
 
 size_t basic_thread_pool_size(basic_thread_pool_s *pool);
 
+/* bytes of the pool and its queued tasks, not the stacks of its threads */
+size_t basic_thread_pool_memory_usage(basic_thread_pool_s *pool);
+
 void basic_thread_pool_stop_and_free(basic_thread_pool_s **pool_ref);
 
 #endif /* BASIC_THREAD_POOL_H */
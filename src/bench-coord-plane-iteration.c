@@ -0,0 +1,864 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* bench-coord-plane-iteration.c: fixed scenes, machine-readable timings */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#define BENCH_COORD_PLANE_ITERATION_VERSION "0.1.0"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <logerr-die.h>
+#include <alloc-or-die.h>
+#include <coord-plane-iteration.h>
+#include <bench-scenes.h>
+
+typedef struct bench_result {
+	const bench_scene_s *scene;
+	uint32_t width;
+	uint32_t height;
+	uint32_t threads;
+	uint64_t iterations;
+	uint64_t point_steps;
+	size_t escaped;
+	size_t not_escaped;
+	uint64_t first_frame_usec;
+	uint64_t settle_usec;
+	uint64_t total_usec;
+	/* median absolute deviation over --repeat runs, else 0 */
+	double points_per_sec_mad;
+	coordinate_plane_stats_s stats;
+} bench_result_s;
+
+/* a row of a previous csv run, see --baseline */
+typedef struct bench_baseline {
+	char scene[80];
+	uint32_t width;
+	uint32_t height;
+	uint32_t threads;
+	double points_per_sec;
+	double points_per_sec_mad;
+} bench_baseline_s;
+
+/*
+ One row of a scaling study, relative to the first (smallest) thread
+ count of its series. Speedup compares the median point-steps per second
+ of --repeat runs, so for the weak series, where the work grows with the
+ thread count, it is the scaled speedup of Gustafson's law rather than
+ the fixed-size speedup of Amdahl's law.
+*/
+typedef struct bench_scaling {
+	bench_result_s result;
+	double speedup;
+	double efficiency;
+	double merge_fraction;
+	double pool_wait_fraction;
+} bench_scaling_s;
+
+typedef struct bench_options {
+	const char *format;
+	const char *scene;
+	const char *sizes;
+	const char *threads;
+	const char *scaling;
+	const char *baseline;
+	uint64_t iterations;
+	uint32_t repeat;
+	double tolerance;
+	int help;
+	int version;
+} bench_options_s;
+
+static uint64_t bench_time_in_usec(void)
+{
+	struct timespec ts = { 0, 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t usec_per_sec = (1000 * 1000);
+	return (usec_per_sec * ts.tv_sec) + (ts.tv_nsec / 1000);
+}
+
+/*
+ time to first frame: from creating the plane through the first single
+ iteration, what an interactive frontend has to show something.
+ time to settle: until the end of the last chunk in which any point
+ escaped; after that the picture no longer changes within the run.
+*/
+static void bench_run(const bench_scene_s *scene, uint32_t width,
+		      uint32_t height, uint32_t threads, uint64_t iterations,
+		      bench_result_s *result)
+{
+	width *= scene->bench_scale;
+	height *= scene->bench_scale;
+	long double resolution = scene->x_span / width;
+	uint32_t skip_rounds = 0;
+
+	uint64_t start = bench_time_in_usec();
+	coordinate_plane_s *plane =
+	    coordinate_plane_new("bench", width, height, scene->center,
+				 resolution, resolution, scene->pfuncs_idx,
+				 scene->seed, iterations, skip_rounds,
+				 threads);
+	coordinate_plane_iterate(plane, 1);
+	uint64_t first = bench_time_in_usec();
+	uint64_t settled = first;
+
+	uint32_t chunk = 1;
+	uint32_t max_chunk = 256;
+	while (coordinate_plane_iteration_count(plane) < iterations) {
+		size_t newly_escaped = coordinate_plane_iterate(plane, chunk);
+		if (newly_escaped) {
+			settled = bench_time_in_usec();
+		}
+		if (chunk < max_chunk) {
+			chunk *= 2;
+		}
+	}
+	uint64_t end = bench_time_in_usec();
+
+	result->scene = scene;
+	result->width = width;
+	result->height = height;
+	result->threads = threads;
+	result->iterations = coordinate_plane_iteration_count(plane);
+	result->point_steps = coordinate_plane_point_steps(plane);
+	result->escaped = coordinate_plane_escaped_count(plane);
+	result->not_escaped = coordinate_plane_not_escaped_count(plane);
+	result->first_frame_usec = first - start;
+	result->settle_usec = settled - start;
+	result->total_usec = end - start;
+	result->points_per_sec_mad = 0.0;
+	coordinate_plane_stats(plane, &result->stats);
+
+	coordinate_plane_free(plane);
+}
+
+static double bench_per_sec(uint64_t count, uint64_t usec)
+{
+	return (usec ? ((1000.0 * 1000.0 * count) / usec) : 0.0);
+}
+
+static int bench_compare_double(const void *a, const void *b)
+{
+	double x = *(const double *)a;
+	double y = *(const double *)b;
+	return (x > y) - (x < y);
+}
+
+/* keeps the run with the median throughput, and the spread around it */
+static void bench_run_median(const bench_scene_s *scene, uint32_t width,
+			     uint32_t height, uint32_t threads,
+			     uint64_t iterations, uint32_t repeat,
+			     bench_result_s *result)
+{
+	repeat = repeat ? repeat : 1;
+	bench_result_s *runs = NULL;
+	alloc_or_die(&runs, sizeof(bench_result_s) * repeat);
+	double *pps = NULL;
+	alloc_or_die(&pps, sizeof(double) * repeat);
+
+	for (size_t i = 0; i < repeat; ++i) {
+		bench_run(scene, width, height, threads, iterations, runs + i);
+		pps[i] = bench_per_sec(runs[i].point_steps,
+				       runs[i].total_usec);
+	}
+	qsort(pps, repeat, sizeof(double), bench_compare_double);
+	double median = pps[repeat / 2];
+
+	size_t closest = 0;
+	for (size_t i = 0; i < repeat; ++i) {
+		double p = bench_per_sec(runs[i].point_steps,
+					 runs[i].total_usec);
+		double c = bench_per_sec(runs[closest].point_steps,
+					 runs[closest].total_usec);
+		if (fabs(p - median) < fabs(c - median)) {
+			closest = i;
+		}
+	}
+	*result = runs[closest];
+
+	for (size_t i = 0; i < repeat; ++i) {
+		pps[i] = fabs(pps[i] - median);
+	}
+	qsort(pps, repeat, sizeof(double), bench_compare_double);
+	result->points_per_sec_mad = pps[repeat / 2];
+
+	free(pps);
+	free(runs);
+}
+
+static void bench_print_header(FILE *out, const char *format)
+{
+	if (strcmp(format, "csv") == 0) {
+		fprintf(out, "scene,function,width,height,threads,iterations,"
+			"escaped,not_escaped,point_steps,points_per_sec,"
+			"iterations_per_sec,first_frame_usec,settle_usec,"
+			"total_usec,points_per_sec_mad\n");
+	} else {
+		fprintf(out, "[\n");
+	}
+}
+
+static void bench_print_result(FILE *out, const char *format,
+			       bench_result_s *r, int first)
+{
+	double pps = bench_per_sec(r->point_steps, r->total_usec);
+	double ips = bench_per_sec(r->iterations, r->total_usec);
+	const char *function = pfuncs[r->scene->pfuncs_idx].name;
+
+	if (strcmp(format, "csv") == 0) {
+		fprintf(out, "%s,%s,%" PRIu32 ",%" PRIu32 ",%" PRIu32
+			",%" PRIu64 ",%zu,%zu,%" PRIu64 ",%.0f,%.1f,%" PRIu64
+			",%" PRIu64 ",%" PRIu64 ",%.0f\n", r->scene->name,
+			function, r->width, r->height, r->threads,
+			r->iterations, r->escaped, r->not_escaped,
+			r->point_steps, pps, ips, r->first_frame_usec,
+			r->settle_usec, r->total_usec, r->points_per_sec_mad);
+	} else {
+		fprintf(out, "%s  {\"scene\": \"%s\", \"function\": \"%s\","
+			" \"width\": %" PRIu32 ", \"height\": %" PRIu32 ","
+			" \"threads\": %" PRIu32 ", \"iterations\": %" PRIu64
+			", \"escaped\": %zu, \"not_escaped\": %zu,"
+			" \"point_steps\": %" PRIu64 ","
+			" \"points_per_sec\": %.0f,"
+			" \"iterations_per_sec\": %.1f,"
+			" \"first_frame_usec\": %" PRIu64 ","
+			" \"settle_usec\": %" PRIu64 ","
+			" \"total_usec\": %" PRIu64 ","
+			" \"points_per_sec_mad\": %.0f}",
+			first ? "" : ",\n", r->scene->name, function, r->width,
+			r->height, r->threads, r->iterations, r->escaped,
+			r->not_escaped, r->point_steps, pps, ips,
+			r->first_frame_usec, r->settle_usec, r->total_usec,
+			r->points_per_sec_mad);
+	}
+	fflush(out);
+}
+
+static void bench_print_footer(FILE *out, const char *format)
+{
+	if (strcmp(format, "csv") != 0) {
+		fprintf(out, "\n]\n");
+	}
+}
+
+static void bench_print_help(FILE *out, const char *argv0)
+{
+	fprintf(out, "%s version %s\n", argv0,
+		BENCH_COORD_PLANE_ITERATION_VERSION);
+	fprintf(out, "OPTIONS:\n");
+	fprintf(out, "\t-o --format=s      'json' (default) or 'csv'\n");
+	fprintf(out, "\t-n --scene=s       Only the named scene\n");
+	fprintf(out, "\t-z --sizes=s       Comma separated WxH list\n");
+	fprintf(out, "\t                           default is '320x240,800x600'\n");
+	fprintf(out, "\t                           times each scene's scale\n");
+	fprintf(out, "\t-c --threads=s     Comma separated thread counts\n");
+	fprintf(out, "\t                           default 1,2,4.. up to nproc\n");
+	fprintf(out, "\t-a --iterations=n  Override each scene's iterations\n");
+	fprintf(out, "\t-r --repeat=n      Runs of each, keeping the median\n");
+	fprintf(out, "\t                           default is '1'\n");
+	fprintf(out, "\t-b --baseline=f    Compare with a previous csv run,\n");
+	fprintf(out, "\t                           exit non-zero if slower\n");
+	fprintf(out, "\t-t --tolerance=n   Percent slower than the baseline\n");
+	fprintf(out, "\t                           allowed, default is '10'\n");
+	fprintf(out, "\t-s --scaling=s     'strong' or 'weak' scaling study\n");
+	fprintf(out, "\t                           weak grows each size with\n");
+	fprintf(out, "\t                           the thread count; speedups\n");
+	fprintf(out, "\t                           are the --repeat median\n");
+	fprintf(out, "\t-l --list          List the scenes and exit\n");
+	fprintf(out, "\t-V --version       Print version and exit\n");
+	fprintf(out, "\t-H --help          This message and exit\n");
+}
+
+static void bench_list_scenes(FILE *out)
+{
+	for (size_t i = 0; i < bench_scenes_len; ++i) {
+		const bench_scene_s *s = bench_scenes + i;
+		fprintf(out, "%s: %s center: %Lg,%Lg span: %Lg",
+			s->name, pfuncs[s->pfuncs_idx].name, s->center.x,
+			s->center.y, s->x_span);
+		if (s->pfuncs_idx == pfuncs_julia_idx) {
+			fprintf(out, " seed: %Lg,%Lg", s->seed.x, s->seed.y);
+		}
+		fprintf(out, " iterations: %" PRIu64, s->iterations);
+		if (s->bench_scale > 1) {
+			fprintf(out, " scale: %" PRIu32, s->bench_scale);
+		}
+		fprintf(out, "\n");
+	}
+}
+
+static void bench_options_parse(bench_options_s *options, int argc,
+				char **argv)
+{
+	options->format = "json";
+	options->scene = NULL;
+	options->sizes = "320x240,800x600";
+	options->threads = NULL;
+	options->scaling = NULL;
+	options->baseline = NULL;
+	options->iterations = 0;
+	options->repeat = 1;
+	options->tolerance = 10.0;
+	options->help = 0;
+	options->version = 0;
+
+	const char *optstring = "HVlo:n:z:c:a:s:r:b:t:";
+	struct option long_options[] = {
+		{ "help", no_argument, 0, 'H' },
+		{ "version", no_argument, 0, 'V' },
+		{ "list", no_argument, 0, 'l' },
+		{ "format", required_argument, 0, 'o' },
+		{ "scene", required_argument, 0, 'n' },
+		{ "sizes", required_argument, 0, 'z' },
+		{ "threads", required_argument, 0, 'c' },
+		{ "iterations", required_argument, 0, 'a' },
+		{ "scaling", required_argument, 0, 's' },
+		{ "repeat", required_argument, 0, 'r' },
+		{ "baseline", required_argument, 0, 'b' },
+		{ "tolerance", required_argument, 0, 't' },
+		{ 0, 0, 0, 0 }
+	};
+
+	while (1) {
+		int option_index = 0;
+		int opt_char = getopt_long(argc, argv, optstring, long_options,
+					   &option_index);
+		if (opt_char == -1) {
+			break;
+		}
+		switch (opt_char) {
+		case 'H':
+			options->help = 1;
+			break;
+		case 'V':
+			options->version = 1;
+			break;
+		case 'l':
+			bench_list_scenes(stdout);
+			exit(EXIT_SUCCESS);
+			break;
+		case 'o':
+			options->format = optarg;
+			break;
+		case 'n':
+			options->scene = optarg;
+			break;
+		case 'z':
+			options->sizes = optarg;
+			break;
+		case 'c':
+			options->threads = optarg;
+			break;
+		case 'a':
+			options->iterations = strtoull(optarg, NULL, 10);
+			break;
+		case 's':
+			options->scaling = optarg;
+			break;
+		case 'r':
+			options->repeat = strtoul(optarg, NULL, 10);
+			break;
+		case 'b':
+			options->baseline = optarg;
+			break;
+		case 't':
+			options->tolerance = strtod(optarg, NULL);
+			break;
+		default:
+			options->help = 1;
+			break;
+		}
+	}
+
+	if (strcmp(options->format, "json") && strcmp(options->format, "csv")) {
+		fprintf(stderr, "unknown --format '%s'\n", options->format);
+		options->help = 1;
+	}
+	if (options->scaling && strcmp(options->scaling, "strong")
+	    && strcmp(options->scaling, "weak")) {
+		fprintf(stderr, "unknown --scaling '%s'\n", options->scaling);
+		options->help = 1;
+	}
+}
+
+/* parses "1,2,4" into out, returns the count */
+static size_t bench_parse_uint_list(const char *str, uint32_t *out,
+				    size_t out_len)
+{
+	size_t len = 0;
+	const char *pos = str;
+	while (pos && *pos && len < out_len) {
+		char *end = NULL;
+		unsigned long val = strtoul(pos, &end, 10);
+		if (end == pos) {
+			break;
+		}
+		if (val) {
+			out[len++] = (uint32_t)val;
+		}
+		pos = (*end == ',') ? end + 1 : NULL;
+	}
+	return len;
+}
+
+/* parses "320x240,800x600" into widths and heights, returns the count */
+static size_t bench_parse_sizes(const char *str, uint32_t *widths,
+				uint32_t *heights, size_t out_len)
+{
+	size_t len = 0;
+	const char *pos = str;
+	while (pos && *pos && len < out_len) {
+		char *end = NULL;
+		unsigned long w = strtoul(pos, &end, 10);
+		if (end == pos || (*end != 'x' && *end != 'X')) {
+			break;
+		}
+		pos = end + 1;
+		unsigned long h = strtoul(pos, &end, 10);
+		if (end == pos) {
+			break;
+		}
+		if (w && h) {
+			widths[len] = (uint32_t)w;
+			heights[len] = (uint32_t)h;
+			++len;
+		}
+		pos = (*end == ',') ? end + 1 : NULL;
+	}
+	return len;
+}
+
+static size_t bench_default_threads(uint32_t *out, size_t out_len)
+{
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	uint32_t max = (nproc > 0) ? (uint32_t)nproc : 1;
+#ifdef SKIP_THREADS
+	max = 1;
+#endif
+	size_t len = 0;
+	for (uint32_t t = 1; t < max && len < out_len; t *= 2) {
+		out[len++] = t;
+	}
+	if (len < out_len) {
+		out[len++] = max;
+	}
+	return len;
+}
+
+/* splits a csv line in place, returns the number of fields */
+static size_t bench_csv_split(char *line, char **fields, size_t fields_len)
+{
+	size_t len = 0;
+	char *pos = line;
+	while (pos && len < fields_len) {
+		fields[len++] = pos;
+		pos = strchr(pos, ',');
+		if (pos) {
+			*pos++ = '\0';
+		}
+	}
+	if (len) {
+		char *last = fields[len - 1];
+		last[strcspn(last, "\r\n")] = '\0';
+	}
+	return len;
+}
+
+static int bench_csv_column(char **fields, size_t len, const char *name)
+{
+	for (size_t i = 0; i < len; ++i) {
+		if (strcmp(fields[i], name) == 0) {
+			return (int)i;
+		}
+	}
+	return -1;
+}
+
+/* reads the csv written by a previous run, found by the header names */
+static bench_baseline_s *bench_baseline_load(const char *path, size_t *len)
+{
+	FILE *in = fopen(path, "r");
+	if (!in) {
+		die("could not open baseline '%s'", path);
+	}
+
+	char line[1024];
+	char *fields[32];
+	if (!fgets(line, sizeof(line), in)) {
+		die("empty baseline '%s'", path);
+	}
+	size_t fields_len = bench_csv_split(line, fields, 32);
+	int scene = bench_csv_column(fields, fields_len, "scene");
+	int width = bench_csv_column(fields, fields_len, "width");
+	int height = bench_csv_column(fields, fields_len, "height");
+	int threads = bench_csv_column(fields, fields_len, "threads");
+	int pps = bench_csv_column(fields, fields_len, "points_per_sec");
+	int mad = bench_csv_column(fields, fields_len, "points_per_sec_mad");
+	if (scene < 0 || width < 0 || height < 0 || threads < 0 || pps < 0) {
+		die("'%s' is not a csv from --format=csv", path);
+	}
+
+	size_t capacity = 16;
+	bench_baseline_s *baselines = NULL;
+	alloc_or_die(&baselines, sizeof(bench_baseline_s) * capacity);
+	*len = 0;
+	while (fgets(line, sizeof(line), in)) {
+		fields_len = bench_csv_split(line, fields, 32);
+		if ((int)fields_len <= pps || (int)fields_len <= threads) {
+			continue;
+		}
+		if (*len == capacity) {
+			capacity *= 2;
+			bench_baseline_s *bigger = NULL;
+			alloc_or_die(&bigger, sizeof(bench_baseline_s) *
+				     capacity);
+			memcpy(bigger, baselines,
+			       sizeof(bench_baseline_s) * (*len));
+			free(baselines);
+			baselines = bigger;
+		}
+		bench_baseline_s *b = baselines + (*len)++;
+		snprintf(b->scene, sizeof(b->scene), "%s", fields[scene]);
+		b->width = strtoul(fields[width], NULL, 10);
+		b->height = strtoul(fields[height], NULL, 10);
+		b->threads = strtoul(fields[threads], NULL, 10);
+		b->points_per_sec = strtod(fields[pps], NULL);
+		b->points_per_sec_mad = ((mad >= 0) && ((int)fields_len > mad))
+		    ? strtod(fields[mad], NULL) : 0.0;
+	}
+	fclose(in);
+	return baselines;
+}
+
+/*
+ A run is a regression if it is slower than the baseline by more than
+ the tolerance and also by more than three times the combined spread of
+ the two measurements, so that a noisy host needs a bigger difference.
+ Returns 1 for a regression.
+*/
+static int bench_baseline_check(FILE *log, bench_baseline_s *baselines,
+				size_t len, bench_result_s *r,
+				double tolerance)
+{
+	bench_baseline_s *b = NULL;
+	for (size_t i = 0; i < len && !b; ++i) {
+		if (strcmp(baselines[i].scene, r->scene->name) == 0
+		    && baselines[i].width == r->width
+		    && baselines[i].height == r->height
+		    && baselines[i].threads == r->threads) {
+			b = baselines + i;
+		}
+	}
+
+	double pps = bench_per_sec(r->point_steps, r->total_usec);
+	fprintf(log, "%-16s %4" PRIu32 "x%-4" PRIu32 " threads: %-3" PRIu32,
+		r->scene->name, r->width, r->height, r->threads);
+	if (!b || b->points_per_sec <= 0.0) {
+		fprintf(log, " %12.0f (not in baseline)\n", pps);
+		return 0;
+	}
+
+	double allowed = b->points_per_sec * (tolerance / 100.0);
+	double noise = 3.0 * (b->points_per_sec_mad + r->points_per_sec_mad);
+	if (noise > allowed) {
+		allowed = noise;
+	}
+	double change = 100.0 * (pps - b->points_per_sec) / b->points_per_sec;
+	int regressed = ((b->points_per_sec - pps) > allowed);
+	fprintf(log, " %12.0f vs %12.0f (%+6.1f%%) %s\n", pps,
+		b->points_per_sec, change, regressed ? "REGRESSION" : "ok");
+	return regressed;
+}
+
+static double bench_ratio(uint64_t num, uint64_t den)
+{
+	return den ? ((1.0 * num) / den) : 0.0;
+}
+
+/*
+ Amdahl: 1/S = f + (1 - f)/p. With x = 1/p and y = 1/S, y - x = f(1 - x),
+ so the least squares serial fraction is sum((y-x)(1-x)) / sum((1-x)^2).
+*/
+static double bench_amdahl_fit(bench_scaling_s *runs, size_t len)
+{
+	double num = 0.0;
+	double den = 0.0;
+	uint32_t base = runs[0].result.threads;
+	for (size_t i = 0; i < len; ++i) {
+		if (runs[i].speedup <= 0.0) {
+			continue;
+		}
+		double x = (1.0 * base) / runs[i].result.threads;
+		double y = 1.0 / runs[i].speedup;
+		num += (y - x) * (1.0 - x);
+		den += (1.0 - x) * (1.0 - x);
+	}
+	if (den <= 0.0) {
+		return 0.0;
+	}
+	double f = num / den;
+	return (f < 0.0) ? 0.0 : ((f > 1.0) ? 1.0 : f);
+}
+
+/*
+ Gustafson: S = p - f(p - 1), so p - S = f(p - 1) and the least squares
+ serial fraction is sum((p-S)(p-1)) / sum((p-1)^2).
+*/
+static double bench_gustafson_fit(bench_scaling_s *runs, size_t len)
+{
+	double num = 0.0;
+	double den = 0.0;
+	uint32_t base = runs[0].result.threads;
+	for (size_t i = 0; i < len; ++i) {
+		if (runs[i].speedup <= 0.0) {
+			continue;
+		}
+		double p = (1.0 * runs[i].result.threads) / base;
+		num += (p - runs[i].speedup) * (p - 1.0);
+		den += (p - 1.0) * (p - 1.0);
+	}
+	if (den <= 0.0) {
+		return 0.0;
+	}
+	double f = num / den;
+	return (f < 0.0) ? 0.0 : ((f > 1.0) ? 1.0 : f);
+}
+
+static void bench_scaling_series(const bench_scene_s *scene, int weak,
+				 uint32_t width, uint32_t height,
+				 uint32_t *threads, size_t threads_len,
+				 uint64_t iterations, uint32_t repeat,
+				 bench_scaling_s *runs)
+{
+	for (size_t i = 0; i < threads_len; ++i) {
+		bench_scaling_s *run = runs + i;
+		uint32_t w = width;
+		uint32_t h = height;
+		if (weak) {
+			double grow = sqrt((1.0 * threads[i]) / threads[0]);
+			w = (uint32_t)((width * grow) + 0.5);
+			h = (uint32_t)((height * grow) + 0.5);
+		}
+		bench_run_median(scene, w, h, threads[i], iterations, repeat,
+				 &run->result);
+
+		bench_result_s *r = &run->result;
+		coordinate_plane_stats_s *st = &r->stats;
+		double base_pps = bench_per_sec(runs[0].result.point_steps,
+						runs[0].result.total_usec);
+		double pps = bench_per_sec(r->point_steps, r->total_usec);
+		double p = (1.0 * threads[i]) / threads[0];
+		run->speedup = (base_pps > 0.0) ? (pps / base_pps) : 0.0;
+		run->efficiency = run->speedup / p;
+		run->merge_fraction =
+		    bench_ratio(st->merge_nsec, st->iterate_nsec);
+		run->pool_wait_fraction = 1.0 -
+		    bench_ratio(st->worker_busy_nsec, st->worker_slots_nsec);
+		if (run->pool_wait_fraction < 0.0) {
+			run->pool_wait_fraction = 0.0;
+		}
+	}
+}
+
+static void bench_scaling_print_header(FILE *out, const char *format)
+{
+	if (strcmp(format, "csv") == 0) {
+		fprintf(out, "scaling,scene,function,width,height,threads,"
+			"point_steps,points_per_sec,total_usec,speedup,"
+			"efficiency,merge_fraction,pool_wait_fraction,"
+			"amdahl_serial_fraction,gustafson_serial_fraction\n");
+	} else {
+		fprintf(out, "[\n");
+	}
+}
+
+static void bench_scaling_print(FILE *out, const char *format,
+				const char *scaling, bench_scaling_s *runs,
+				size_t len, int first)
+{
+	/* Amdahl only models a fixed problem size, Gustafson a growing one */
+	int weak = (strcmp(scaling, "weak") == 0);
+	double f = weak ? bench_gustafson_fit(runs, len)
+	    : bench_amdahl_fit(runs, len);
+	char fit[40];
+	snprintf(fit, sizeof(fit), weak ? ",%.4f" : "%.4f,", f);
+	const bench_scene_s *scene = runs[0].result.scene;
+	const char *function = pfuncs[scene->pfuncs_idx].name;
+	int csv = (strcmp(format, "csv") == 0);
+
+	if (!csv && weak) {
+		fprintf(out, "%s  {\"scaling\": \"%s\", \"scene\": \"%s\","
+			" \"function\": \"%s\","
+			" \"gustafson_serial_fraction\": %.4f,\n"
+			"    \"runs\": [\n", first ? "" : ",\n", scaling,
+			scene->name, function, f);
+	} else if (!csv) {
+		fprintf(out, "%s  {\"scaling\": \"%s\", \"scene\": \"%s\","
+			" \"function\": \"%s\","
+			" \"amdahl_serial_fraction\": %.4f,"
+			" \"amdahl_max_speedup\": %.1f,\n    \"runs\": [\n",
+			first ? "" : ",\n", scaling, scene->name, function, f,
+			(f > 0.0) ? (1.0 / f) : 0.0);
+	}
+	for (size_t i = 0; i < len; ++i) {
+		bench_scaling_s *run = runs + i;
+		bench_result_s *r = &run->result;
+		double pps = bench_per_sec(r->point_steps, r->total_usec);
+		if (csv) {
+			fprintf(out, "%s,%s,%s,%" PRIu32 ",%" PRIu32 ",%"
+				PRIu32 ",%" PRIu64 ",%.0f,%" PRIu64
+				",%.3f,%.3f,%.4f,%.4f,%s\n", scaling,
+				scene->name, function, r->width, r->height,
+				r->threads, r->point_steps, pps, r->total_usec,
+				run->speedup, run->efficiency,
+				run->merge_fraction, run->pool_wait_fraction,
+				fit);
+		} else {
+			fprintf(out, "      {\"width\": %" PRIu32 ","
+				" \"height\": %" PRIu32 ","
+				" \"threads\": %" PRIu32 ","
+				" \"point_steps\": %" PRIu64 ","
+				" \"points_per_sec\": %.0f,"
+				" \"total_usec\": %" PRIu64 ","
+				" \"speedup\": %.3f, \"efficiency\": %.3f,"
+				" \"merge_fraction\": %.4f,"
+				" \"pool_wait_fraction\": %.4f}%s\n",
+				r->width, r->height, r->threads,
+				r->point_steps, pps, r->total_usec,
+				run->speedup, run->efficiency,
+				run->merge_fraction, run->pool_wait_fraction,
+				(i + 1 < len) ? "," : "");
+		}
+	}
+	if (!csv) {
+		fprintf(out, "    ]}");
+	}
+	fflush(out);
+}
+
+static void bench_scaling_study(bench_options_s *options, uint32_t *threads,
+				size_t threads_len, uint32_t *widths,
+				uint32_t *heights, size_t sizes_len)
+{
+	int weak = (strcmp(options->scaling, "weak") == 0);
+	bench_scaling_s *runs = NULL;
+	alloc_or_die(&runs, sizeof(bench_scaling_s) * threads_len);
+
+	FILE *out = stdout;
+	bench_scaling_print_header(out, options->format);
+	int first = 1;
+	for (size_t i = 0; i < bench_scenes_len; ++i) {
+		const bench_scene_s *scene = bench_scenes + i;
+		if (options->scene && strcmp(options->scene, scene->name)) {
+			continue;
+		}
+		uint64_t iterations = options->iterations ?
+		    options->iterations : scene->iterations;
+		for (size_t j = 0; j < sizes_len; ++j) {
+			bench_scaling_series(scene, weak, widths[j],
+					     heights[j], threads, threads_len,
+					     iterations, options->repeat, runs);
+			bench_scaling_print(out, options->format,
+					    options->scaling, runs,
+					    threads_len, first);
+			first = 0;
+		}
+	}
+	bench_print_footer(out, options->format);
+
+	free(runs);
+}
+
+int main(int argc, char **argv)
+{
+	signal(SIGSEGV, backtrace_exit_handler);
+
+	bench_options_s options;
+	bench_options_parse(&options, argc, argv);
+	if (options.help) {
+		bench_print_help(stdout, argv[0]);
+		exit(EXIT_SUCCESS);
+	}
+	if (options.version) {
+		fprintf(stdout, "%s\n", BENCH_COORD_PLANE_ITERATION_VERSION);
+		exit(EXIT_SUCCESS);
+	}
+
+	uint32_t threads[64];
+	size_t threads_len = 0;
+	if (options.threads) {
+		threads_len = bench_parse_uint_list(options.threads, threads,
+						    64);
+	} else {
+		threads_len = bench_default_threads(threads, 64);
+	}
+
+	uint32_t widths[64];
+	uint32_t heights[64];
+	size_t sizes_len =
+	    bench_parse_sizes(options.sizes, widths, heights, 64);
+
+	if (!threads_len || !sizes_len) {
+		die("%s", "no thread counts or sizes to run");
+	}
+
+	if (options.scaling) {
+		bench_scaling_study(&options, threads, threads_len, widths,
+				    heights, sizes_len);
+		return 0;
+	}
+
+	bench_baseline_s *baselines = NULL;
+	size_t baselines_len = 0;
+	if (options.baseline) {
+		baselines = bench_baseline_load(options.baseline,
+						&baselines_len);
+	}
+	size_t regressions = 0;
+
+	FILE *out = stdout;
+	bench_print_header(out, options.format);
+	int first = 1;
+	for (size_t i = 0; i < bench_scenes_len; ++i) {
+		const bench_scene_s *scene = bench_scenes + i;
+		if (options.scene && strcmp(options.scene, scene->name)) {
+			continue;
+		}
+		uint64_t iterations = options.iterations ?
+		    options.iterations : scene->iterations;
+		for (size_t j = 0; j < sizes_len; ++j) {
+			for (size_t k = 0; k < threads_len; ++k) {
+				bench_result_s result;
+				bench_run_median(scene, widths[j], heights[j],
+						 threads[k], iterations,
+						 options.repeat, &result);
+				bench_print_result(out, options.format,
+						   &result, first);
+				first = 0;
+				if (baselines) {
+					regressions +=
+					    bench_baseline_check(stderr,
+								 baselines,
+								 baselines_len,
+								 &result,
+								 options.tolerance);
+				}
+			}
+		}
+	}
+	bench_print_footer(out, options.format);
+
+	free(baselines);
+	if (regressions) {
+		fprintf(stderr, "%zu slower than baseline '%s'\n",
+			regressions, options.baseline);
+		return 1;
+	}
+
+	return 0;
+}
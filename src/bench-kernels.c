@@ -0,0 +1,289 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* bench-kernels.c: ns per step of each pfunc, outside of the plane */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#define BENCH_KERNELS_VERSION "0.1.0"
+
+#include <float.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <string.h>
+#include <time.h>
+
+#include <logerr-die.h>
+#include <coord-plane-iteration.h>
+
+/*
+ Each kernel is called through the pfuncs[] table, as the plane does,
+ over a small block of points which stays in L1. Every rounds_per_reset
+ steps the block is copied back from a pristine set so that no kernel
+ wanders into inf or NaN, where x87 arithmetic is much slower; the cost
+ of that copy is measured alone and subtracted.
+*/
+#define bench_kernels_points 256
+#define bench_kernels_rounds_per_reset 16
+
+typedef struct bench_kernels_block {
+	iterxy_s pristine[bench_kernels_points];
+	iterxy_s points[bench_kernels_points];
+} bench_kernels_block_s;
+
+typedef struct bench_kernels_result {
+	const char *name;
+	double reset_ns;
+	double step_ns;
+	double escape_ns;
+	double combined_ns;
+} bench_kernels_result_s;
+
+/* keeps the compiler from discarding escape checks */
+static volatile size_t bench_kernels_sink = 0;
+
+static uint64_t bench_kernels_time_in_nsec(void)
+{
+	struct timespec ts = { 0, 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t nsec_per_sec = (1000 * 1000 * 1000);
+	return (nsec_per_sec * ts.tv_sec) + ts.tv_nsec;
+}
+
+/* a grid inside the main cardioid, and a Julia seed whose filled set
+   contains the grid, so most orbits stay bounded between resets */
+static void bench_kernels_block_init(bench_kernels_block_s *block,
+				     const named_pfunc_s *named)
+{
+	ldxy_s seed = { -0.12, 0.1 };
+	size_t side = 16;
+	for (size_t i = 0; i < bench_kernels_points; ++i) {
+		ldxy_s xy;
+		xy.x = -0.2 + (0.3 * (i % side)) / side;
+		xy.y = -0.2 + (0.4 * (i / side)) / side;
+		named->pfunc_init(block->pristine + i, xy, seed);
+	}
+	memcpy(block->points, block->pristine, sizeof(block->points));
+}
+
+static void bench_kernels_reset(bench_kernels_block_s *block)
+{
+	memcpy(block->points, block->pristine, sizeof(block->points));
+}
+
+static uint64_t bench_kernels_time_reset(bench_kernels_block_s *block,
+					 uint64_t rounds)
+{
+	uint64_t start = bench_kernels_time_in_nsec();
+	for (uint64_t r = 0; r < rounds; ++r) {
+		bench_kernels_reset(block);
+		bench_kernels_sink += block->points[r % 7].escaped;
+	}
+	return bench_kernels_time_in_nsec() - start;
+}
+
+static uint64_t bench_kernels_time_step(bench_kernels_block_s *block,
+					const named_pfunc_s *named,
+					uint64_t rounds)
+{
+	pfunc_f pfunc = named->pfunc;
+	uint64_t start = bench_kernels_time_in_nsec();
+	for (uint64_t r = 0; r < rounds; ++r) {
+		bench_kernels_reset(block);
+		for (size_t k = 0; k < bench_kernels_rounds_per_reset; ++k) {
+			for (size_t i = 0; i < bench_kernels_points; ++i) {
+				pfunc(block->points + i);
+			}
+		}
+	}
+	return bench_kernels_time_in_nsec() - start;
+}
+
+static uint64_t bench_kernels_time_escape(bench_kernels_block_s *block,
+					  const named_pfunc_s *named,
+					  uint64_t rounds)
+{
+	pfunc_escape_f pfunc_escape = named->pfunc_escape;
+	size_t escaped = 0;
+	uint64_t start = bench_kernels_time_in_nsec();
+	for (uint64_t r = 0; r < rounds; ++r) {
+		bench_kernels_reset(block);
+		for (size_t k = 0; k < bench_kernels_rounds_per_reset; ++k) {
+			for (size_t i = 0; i < bench_kernels_points; ++i) {
+				escaped += pfunc_escape(block->points[i].z);
+			}
+		}
+	}
+	uint64_t elapsed = bench_kernels_time_in_nsec() - start;
+	bench_kernels_sink += escaped;
+	return elapsed;
+}
+
+/* the inner loop of the plane: check, then step if not escaped */
+static uint64_t bench_kernels_time_combined(bench_kernels_block_s *block,
+					    const named_pfunc_s *named,
+					    uint64_t rounds)
+{
+	pfunc_f pfunc = named->pfunc;
+	pfunc_escape_f pfunc_escape = named->pfunc_escape;
+	size_t escaped = 0;
+	uint64_t start = bench_kernels_time_in_nsec();
+	for (uint64_t r = 0; r < rounds; ++r) {
+		bench_kernels_reset(block);
+		for (size_t k = 0; k < bench_kernels_rounds_per_reset; ++k) {
+			for (size_t i = 0; i < bench_kernels_points; ++i) {
+				iterxy_s *p = block->points + i;
+				if (pfunc_escape(p->z)) {
+					++escaped;
+				} else {
+					pfunc(p);
+				}
+			}
+		}
+	}
+	uint64_t elapsed = bench_kernels_time_in_nsec() - start;
+	bench_kernels_sink += escaped;
+	return elapsed;
+}
+
+static double bench_kernels_ns_per_step(uint64_t nsec, uint64_t reset_nsec,
+					uint64_t rounds)
+{
+	double steps = 1.0 * rounds * bench_kernels_rounds_per_reset *
+	    bench_kernels_points;
+	double net = (nsec > reset_nsec) ? (1.0 * (nsec - reset_nsec)) : 0.0;
+	return net / steps;
+}
+
+static void bench_kernels_run(const named_pfunc_s *named,
+			      uint64_t min_nsec, bench_kernels_result_s *out)
+{
+	bench_kernels_block_s block;
+	bench_kernels_block_init(&block, named);
+
+	/* warm up, and find a round count which takes min_nsec */
+	uint64_t rounds = 1;
+	while (bench_kernels_time_combined(&block, named, rounds) < min_nsec) {
+		rounds *= 2;
+	}
+
+	uint64_t reset = bench_kernels_time_reset(&block, rounds);
+	uint64_t step = bench_kernels_time_step(&block, named, rounds);
+	uint64_t escape = bench_kernels_time_escape(&block, named, rounds);
+	uint64_t combined = bench_kernels_time_combined(&block, named, rounds);
+
+	double points_per_round = 1.0 * bench_kernels_points;
+
+	out->name = named->name;
+	out->reset_ns = reset / (rounds * points_per_round);
+	out->step_ns = bench_kernels_ns_per_step(step, reset, rounds);
+	out->escape_ns = bench_kernels_ns_per_step(escape, reset, rounds);
+	out->combined_ns = bench_kernels_ns_per_step(combined, reset, rounds);
+}
+
+static const char *bench_kernels_isa(void)
+{
+#if defined(__AVX512F__)
+	return "avx512f";
+#elif defined(__AVX2__)
+	return "avx2";
+#elif defined(__AVX__)
+	return "avx";
+#elif defined(__SSE2__)
+	return "sse2";
+#elif defined(__aarch64__)
+	return "aarch64";
+#else
+	return "generic";
+#endif
+}
+
+static void bench_kernels_print_help(FILE *out, const char *argv0)
+{
+	fprintf(out, "%s version %s\n", argv0, BENCH_KERNELS_VERSION);
+	fprintf(out, "OPTIONS:\n");
+	fprintf(out, "\t-o --format=s      'text' (default) or 'csv'\n");
+	fprintf(out, "\t-m --min_msec=n    Minimum time per measurement\n");
+	fprintf(out, "\t                           default is '200'\n");
+	fprintf(out, "\t-V --version       Print version and exit\n");
+	fprintf(out, "\t-H --help          This message and exit\n");
+}
+
+int main(int argc, char **argv)
+{
+	signal(SIGSEGV, backtrace_exit_handler);
+
+	const char *format = "text";
+	uint64_t min_msec = 200;
+
+	const char *optstring = "HVo:m:";
+	struct option long_options[] = {
+		{ "help", no_argument, 0, 'H' },
+		{ "version", no_argument, 0, 'V' },
+		{ "format", required_argument, 0, 'o' },
+		{ "min_msec", required_argument, 0, 'm' },
+		{ 0, 0, 0, 0 }
+	};
+	while (1) {
+		int option_index = 0;
+		int opt_char = getopt_long(argc, argv, optstring, long_options,
+					   &option_index);
+		if (opt_char == -1) {
+			break;
+		}
+		switch (opt_char) {
+		case 'V':
+			fprintf(stdout, "%s\n", BENCH_KERNELS_VERSION);
+			exit(EXIT_SUCCESS);
+			break;
+		case 'o':
+			format = optarg;
+			break;
+		case 'm':
+			min_msec = strtoull(optarg, NULL, 10);
+			break;
+		case 'H':
+		default:
+			bench_kernels_print_help(stdout, argv[0]);
+			exit(EXIT_SUCCESS);
+			break;
+		}
+	}
+	if (strcmp(format, "text") != 0 && strcmp(format, "csv") != 0) {
+		fprintf(stderr, "unknown --format '%s'\n", format);
+		bench_kernels_print_help(stderr, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	int csv = (strcmp(format, "csv") == 0);
+
+	/* one tier today: the type of ldxy_s */
+	const char *precision = "long double";
+	int mantissa_bits = LDBL_MANT_DIG;
+	const char *isa = bench_kernels_isa();
+
+	if (csv) {
+		fprintf(stdout, "function,precision,isa,step_ns,escape_ns,"
+			"step_and_escape_ns,reset_ns\n");
+	} else {
+		fprintf(stdout, "precision: %s (%d bit mantissa) isa: %s\n",
+			precision, mantissa_bits, isa);
+		fprintf(stdout, "%-40s %10s %10s %10s\n", "function",
+			"step ns", "escape ns", "both ns");
+	}
+
+	uint64_t min_nsec = min_msec * 1000 * 1000;
+	for (size_t i = 0; i < pfuncs_len; ++i) {
+		bench_kernels_result_s r;
+		bench_kernels_run(pfuncs + i, min_nsec, &r);
+		if (csv) {
+			fprintf(stdout, "%s,%s,%s,%.3f,%.3f,%.3f,%.3f\n",
+				r.name, precision, isa, r.step_ns, r.escape_ns,
+				r.combined_ns, r.reset_ns);
+		} else {
+			fprintf(stdout, "%-40s %10.3f %10.3f %10.3f\n",
+				r.name, r.step_ns, r.escape_ns, r.combined_ns);
+		}
+		fflush(stdout);
+	}
+
+	return 0;
+}
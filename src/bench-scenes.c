@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* bench-scenes.c: fixed scenes shared by the bench and validate tools */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#include <string.h>
+
+#include <bench-scenes.h>
+
+const bench_scene_s bench_scenes[] = {
+	{ "mandlebrot", pfuncs_mandlebrot_idx, { -0.5, 0.0 }, 4.0,
+	 { 0.0, 0.0 }, 1000, 1 },
+	{ "seahorse_valley", pfuncs_mandlebrot_idx, { -0.7453, 0.1127 }, 0.01,
+	 { 0.0, 0.0 }, 2000, 1 },
+	{ "deep_zoom", pfuncs_mandlebrot_idx,
+	 { -0.743643887037158704752191506114774L,
+	  0.131825904205311970493132056385139L }, 1.0e-11L,
+	 { 0.0, 0.0 }, 5000, 1 },
+	{ "julia_default", pfuncs_julia_idx, { 0.0, 0.0 }, 3.2,
+	 { -1.25643, -0.381086 }, 1000, 4 },
+	{ "julia_rabbit", pfuncs_julia_idx, { 0.0, 0.0 }, 3.2,
+	 { -0.123, 0.745 }, 1000, 1 },
+	{ "julia_dendrite", pfuncs_julia_idx, { 0.0, 0.0 }, 3.2,
+	 { 0.0, 1.0 }, 1000, 4 },
+	{ "julia_siegel", pfuncs_julia_idx, { 0.0, 0.0 }, 3.2,
+	 { -0.390541, -0.586788 }, 2000, 1 },
+};
+
+const size_t bench_scenes_len =
+    (sizeof(bench_scenes) / sizeof(bench_scenes[0]));
+
+const bench_scene_s *bench_scene_by_name(const char *name)
+{
+	for (size_t i = 0; i < bench_scenes_len; ++i) {
+		if (strcmp(name, bench_scenes[i].name) == 0) {
+			return bench_scenes + i;
+		}
+	}
+	return NULL;
+}
@@ -0,0 +1,33 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* bench-scenes.h: fixed scenes shared by the bench and validate tools */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#ifndef BENCH_SCENES_H
+#define BENCH_SCENES_H 1
+
+#include <coord-plane-iteration.h>
+
+typedef struct bench_scene {
+	const char *name;
+	size_t pfuncs_idx;
+	ldxy_s center;
+	/* the span of the x-axis; pixels are square */
+	long double x_span;
+	ldxy_s seed;
+	uint64_t iterations;
+	/*
+	 the bench multiplies each side of the requested size by this, so
+	 that scenes where nearly every point escapes at once still run
+	 long enough to time
+	*/
+	uint32_t bench_scale;
+} bench_scene_s;
+
+extern const bench_scene_s bench_scenes[];
+extern const size_t bench_scenes_len;
+
+/* NULL if there is no scene of that name */
+const bench_scene_s *bench_scene_by_name(const char *name);
+
+#endif /* BENCH_SCENES_H */
@@ -0,0 +1,332 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* bench-thread-pool.c: thread pool overhead, independent of the work */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#define BENCH_THREAD_POOL_VERSION "0.1.0"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <logerr-die.h>
+#include <alloc-or-die.h>
+#include <basic-thread-pool.h>
+
+/*
+ Any pool with new/add/wait/free can be measured: add an entry to
+ bench_pools[] wrapping its functions.
+*/
+typedef struct bench_pool_ops {
+	const char *name;
+	void *(*pool_new)(size_t num_threads);
+	int (*pool_add)(void *pool, thrd_start_t func, void *arg);
+	int (*pool_wait)(void *pool);
+	void (*pool_free)(void *pool);
+} bench_pool_ops_s;
+
+static void *basic_pool_new(size_t num_threads)
+{
+	return basic_thread_pool_new(num_threads);
+}
+
+static int basic_pool_add(void *pool, thrd_start_t func, void *arg)
+{
+	return basic_thread_pool_add(pool, func, arg);
+}
+
+static int basic_pool_wait(void *pool)
+{
+	return basic_thread_pool_wait(pool);
+}
+
+static void basic_pool_free(void *pool)
+{
+	basic_thread_pool_s *basic_pool = pool;
+	basic_thread_pool_stop_and_free(&basic_pool);
+}
+
+static const bench_pool_ops_s bench_pools[] = {
+	{ "basic_thread_pool", basic_pool_new, basic_pool_add,
+	 basic_pool_wait, basic_pool_free },
+};
+
+static const size_t bench_pools_len =
+    (sizeof(bench_pools) / sizeof(bench_pools[0]));
+
+typedef struct bench_pool_stamp {
+	uint64_t submitted;
+	atomic_uint_fast64_t started;
+} bench_pool_stamp_s;
+
+typedef struct bench_pool_stats {
+	double median;
+	double p99;
+	double max;
+} bench_pool_stats_s;
+
+typedef struct bench_pool_result {
+	const char *pool;
+	size_t workers;
+	double tasks_per_sec;
+	bench_pool_stats_s submit_to_start_ns;
+	bench_pool_stats_s fork_join_ns;
+	bench_pool_stats_s idle_wake_ns;
+} bench_pool_result_s;
+
+static uint64_t bench_pool_time_in_nsec(void)
+{
+	struct timespec ts = { 0, 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t nsec_per_sec = (1000 * 1000 * 1000);
+	return (nsec_per_sec * ts.tv_sec) + ts.tv_nsec;
+}
+
+static int bench_pool_empty_task(void *arg)
+{
+	(void)arg;
+	return 0;
+}
+
+static int bench_pool_stamp_task(void *arg)
+{
+	bench_pool_stamp_s *stamp = arg;
+	stamp->started = bench_pool_time_in_nsec();
+	return 0;
+}
+
+static int bench_pool_compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void bench_pool_stats(uint64_t *samples, size_t len,
+			     bench_pool_stats_s *out)
+{
+	qsort(samples, len, sizeof(uint64_t), bench_pool_compare_u64);
+	out->median = samples[len / 2];
+	out->p99 = samples[(len * 99) / 100];
+	out->max = samples[len - 1];
+}
+
+static double bench_pool_throughput(const bench_pool_ops_s *ops, void *pool,
+				    size_t tasks)
+{
+	uint64_t start = bench_pool_time_in_nsec();
+	for (size_t i = 0; i < tasks; ++i) {
+		ops->pool_add(pool, bench_pool_empty_task, NULL);
+	}
+	ops->pool_wait(pool);
+	uint64_t elapsed = bench_pool_time_in_nsec() - start;
+	return (1000.0 * 1000.0 * 1000.0 * tasks) / (elapsed ? elapsed : 1);
+}
+
+/* a burst of tasks, each stamping when a worker picked it up */
+static void bench_pool_submit_to_start(const bench_pool_ops_s *ops,
+				       void *pool, bench_pool_stamp_s *stamps,
+				       uint64_t *samples, size_t len,
+				       bench_pool_stats_s *out)
+{
+	for (size_t i = 0; i < len; ++i) {
+		stamps[i].started = 0;
+		stamps[i].submitted = bench_pool_time_in_nsec();
+		ops->pool_add(pool, bench_pool_stamp_task, stamps + i);
+	}
+	ops->pool_wait(pool);
+	for (size_t i = 0; i < len; ++i) {
+		uint64_t started = stamps[i].started;
+		samples[i] = (started > stamps[i].submitted) ?
+		    (started - stamps[i].submitted) : 0;
+	}
+	bench_pool_stats(samples, len, out);
+}
+
+/* what a frame pays: one task per worker, then wait for all of them */
+static void bench_pool_fork_join(const bench_pool_ops_s *ops, void *pool,
+				 size_t workers, uint64_t *samples,
+				 size_t len, bench_pool_stats_s *out)
+{
+	for (size_t i = 0; i < len; ++i) {
+		uint64_t start = bench_pool_time_in_nsec();
+		for (size_t j = 0; j < workers; ++j) {
+			ops->pool_add(pool, bench_pool_empty_task, NULL);
+		}
+		ops->pool_wait(pool);
+		samples[i] = bench_pool_time_in_nsec() - start;
+	}
+	bench_pool_stats(samples, len, out);
+}
+
+/* one task after the workers have had time to go to sleep */
+static void bench_pool_idle_wake(const bench_pool_ops_s *ops, void *pool,
+				 uint64_t *samples, size_t len,
+				 bench_pool_stats_s *out)
+{
+	struct timespec idle = { 0, 2 * 1000 * 1000 };
+	bench_pool_stamp_s stamp;
+	for (size_t i = 0; i < len; ++i) {
+		nanosleep(&idle, NULL);
+		stamp.started = 0;
+		stamp.submitted = bench_pool_time_in_nsec();
+		ops->pool_add(pool, bench_pool_stamp_task, &stamp);
+		ops->pool_wait(pool);
+		uint64_t started = stamp.started;
+		samples[i] = (started > stamp.submitted) ?
+		    (started - stamp.submitted) : 0;
+	}
+	bench_pool_stats(samples, len, out);
+}
+
+static void bench_pool_run(const bench_pool_ops_s *ops, size_t workers,
+			   size_t samples_len, bench_pool_result_s *result)
+{
+	uint64_t *samples = NULL;
+	alloc_or_die(&samples, sizeof(uint64_t) * samples_len);
+	bench_pool_stamp_s *stamps = NULL;
+	alloc_or_die(&stamps, sizeof(bench_pool_stamp_s) * samples_len);
+
+	void *pool = ops->pool_new(workers);
+	if (!pool) {
+		die("%s: could not create %zu workers", ops->name, workers);
+	}
+
+	result->pool = ops->name;
+	result->workers = workers;
+
+	/* warm up */
+	bench_pool_throughput(ops, pool, samples_len);
+
+	result->tasks_per_sec =
+	    bench_pool_throughput(ops, pool, 10 * samples_len);
+	bench_pool_submit_to_start(ops, pool, stamps, samples, samples_len,
+				   &result->submit_to_start_ns);
+	bench_pool_fork_join(ops, pool, workers, samples, samples_len,
+			     &result->fork_join_ns);
+	size_t idle_len = samples_len < 200 ? samples_len : 200;
+	bench_pool_idle_wake(ops, pool, samples, idle_len,
+			     &result->idle_wake_ns);
+
+	ops->pool_free(pool);
+	free(stamps);
+	free(samples);
+}
+
+static void bench_pool_print(FILE *out, int csv, bench_pool_result_s *r)
+{
+	if (csv) {
+		fprintf(out, "%s,%zu,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,"
+			"%.0f,%.0f\n", r->pool, r->workers, r->tasks_per_sec,
+			r->submit_to_start_ns.median,
+			r->submit_to_start_ns.p99, r->submit_to_start_ns.max,
+			r->fork_join_ns.median, r->fork_join_ns.p99,
+			r->fork_join_ns.max, r->idle_wake_ns.median,
+			r->idle_wake_ns.p99, r->idle_wake_ns.max);
+	} else {
+		fprintf(out, "%-20s %7zu %12.0f %10.0f %10.0f %10.0f %10.0f"
+			" %10.0f %10.0f\n", r->pool, r->workers,
+			r->tasks_per_sec, r->submit_to_start_ns.median,
+			r->submit_to_start_ns.p99, r->fork_join_ns.median,
+			r->fork_join_ns.p99, r->idle_wake_ns.median,
+			r->idle_wake_ns.p99);
+	}
+	fflush(out);
+}
+
+static void bench_pool_print_help(FILE *out, const char *argv0)
+{
+	fprintf(out, "%s version %s\n", argv0, BENCH_THREAD_POOL_VERSION);
+	fprintf(out, "OPTIONS:\n");
+	fprintf(out, "\t-o --format=s      'text' (default) or 'csv'\n");
+	fprintf(out, "\t-c --threads=n     Largest worker count to measure\n");
+	fprintf(out, "\t                           default is nproc\n");
+	fprintf(out, "\t-n --samples=n     Samples per latency measure\n");
+	fprintf(out, "\t                           default is '10000'\n");
+	fprintf(out, "\t-V --version       Print version and exit\n");
+	fprintf(out, "\t-H --help          This message and exit\n");
+}
+
+int main(int argc, char **argv)
+{
+	signal(SIGSEGV, backtrace_exit_handler);
+
+	const char *format = "text";
+	long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+	size_t max_workers = (nproc > 0) ? (size_t)nproc : 1;
+	size_t samples_len = 10000;
+
+	const char *optstring = "HVo:c:n:";
+	struct option long_options[] = {
+		{ "help", no_argument, 0, 'H' },
+		{ "version", no_argument, 0, 'V' },
+		{ "format", required_argument, 0, 'o' },
+		{ "threads", required_argument, 0, 'c' },
+		{ "samples", required_argument, 0, 'n' },
+		{ 0, 0, 0, 0 }
+	};
+	while (1) {
+		int option_index = 0;
+		int opt_char = getopt_long(argc, argv, optstring, long_options,
+					   &option_index);
+		if (opt_char == -1) {
+			break;
+		}
+		switch (opt_char) {
+		case 'V':
+			fprintf(stdout, "%s\n", BENCH_THREAD_POOL_VERSION);
+			exit(EXIT_SUCCESS);
+			break;
+		case 'o':
+			format = optarg;
+			break;
+		case 'c':
+			max_workers = strtoul(optarg, NULL, 10);
+			break;
+		case 'n':
+			samples_len = strtoul(optarg, NULL, 10);
+			break;
+		case 'H':
+		default:
+			bench_pool_print_help(stdout, argv[0]);
+			exit(EXIT_SUCCESS);
+			break;
+		}
+	}
+	max_workers = max_workers ? max_workers : 1;
+	samples_len = samples_len ? samples_len : 1;
+	if (strcmp(format, "text") != 0 && strcmp(format, "csv") != 0) {
+		fprintf(stderr, "unknown --format '%s'\n", format);
+		bench_pool_print_help(stderr, argv[0]);
+		exit(EXIT_FAILURE);
+	}
+	int csv = (strcmp(format, "csv") == 0);
+
+	if (csv) {
+		fprintf(stdout, "pool,workers,empty_tasks_per_sec,"
+			"submit_to_start_ns_p50,submit_to_start_ns_p99,"
+			"submit_to_start_ns_max,fork_join_ns_p50,"
+			"fork_join_ns_p99,fork_join_ns_max,idle_wake_ns_p50,"
+			"idle_wake_ns_p99,idle_wake_ns_max\n");
+	} else {
+		fprintf(stdout, "%-20s %7s %12s %10s %10s %10s %10s"
+			" %10s %10s\n", "pool", "workers", "tasks/s",
+			"start p50", "start p99", "fj p50", "fj p99",
+			"wake p50", "wake p99");
+	}
+
+	for (size_t i = 0; i < bench_pools_len; ++i) {
+		for (size_t workers = 1; workers <= max_workers; ++workers) {
+			bench_pool_result_s result;
+			bench_pool_run(bench_pools + i, workers, samples_len,
+				       &result);
+			bench_pool_print(stdout, csv, &result);
+		}
+	}
+
+	return 0;
+}
@@ -5,10 +5,24 @@
 
 #define CLI_COORD_PLANE_ITERATION_VERSION "0.1.0"
 
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
 #include <signal.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
 
 #include <logerr-die.h>
+#include <alloc-or-die.h>
+#include <frame-pacer.h>
+#include <trace-events.h>
+#include <perf-counters.h>
 #include <coord-plane-option-parser.h>
+#include <pixel-coord-plane-iteration.h>
+#include <coord-plane-metrics.h>
+#include <coord-plane-buddhabrot.h>
 
 #ifndef Make_valgrind_happy
 #define Make_valgrind_happy 0
@@ -60,13 +74,12 @@ void fclear_screen(FILE *out)
 
 void fprint_coordinate_plane_ascii(FILE *out, coordinate_plane_s *plane)
 {
-	fclear_screen(out);
 	uint32_t win_height = coordinate_plane_win_height(plane);
 	uint32_t win_width = coordinate_plane_win_width(plane);
-	for (size_t y = 0; y < win_height; ++y) {
+	const uint32_t *row = coordinate_plane_escaped_view(plane);
+	for (size_t y = 0; y < win_height; ++y, row += win_width) {
 		for (size_t x = 0; x < win_width; ++x) {
-			uint64_t escaped =
-			    coordinate_plane_escaped(plane, x, y);
+			uint32_t escaped = row[x];
 			char c;
 			if (escaped == 0) {
 				c = ' ';
@@ -79,26 +92,21 @@ void fprint_coordinate_plane_ascii(FILE *out, coordinate_plane_s *plane)
 			} else {
 				c = '*';
 			}
-			printf("%c", c);
+			fputc(c, out);
 		}
 		fprintf(out, "\n");
 	}
 }
 
-int main(int argc, char **argv)
+void cli_ascii_iteration(coordinate_plane_s *plane)
 {
-	signal(SIGSEGV, backtrace_exit_handler);
-
-	const char *version = CLI_COORD_PLANE_ITERATION_VERSION;
-	coordinate_plane_s *plane =
-	    coordinate_plane_new_from_args(argc, argv, version);
-
 	size_t it_per_frame = 1;
 
 	int halt = 0;
 	for (unsigned long i = 0; !halt; ++i) {
 		int c = 0;
 		coordinate_plane_iterate(plane, it_per_frame);
+		fclear_screen(stdout);
 		fprint_coordinate_plane_ascii(stdout, plane);
 		const char *title = coordinate_plane_function_name(plane);
 		size_t escaped = coordinate_plane_escaped_count(plane);
@@ -120,6 +128,662 @@ int main(int argc, char **argv)
 		}
 	}
 	fprintf(stdout, "\n");
+}
+
+/* no intermediate output: iterate in chunks which grow while each
+   takes less than a tenth of a second, then report only the result */
+void cli_batch_iteration(coordinate_plane_s *plane, const char *output,
+			 coordinate_plane_metrics_s *metrics)
+{
+	uint64_t halt_after = coordinate_plane_halt_after(plane);
+	if (!halt_after) {
+		die("%s", "--batch requires --halt_after");
+	}
+
+	uint64_t usec_per_chunk = (1000 * 1000) / 10;
+	uint32_t chunk = 1;
+	while (coordinate_plane_iteration_count(plane) < halt_after) {
+		uint64_t before = time_in_usec();
+		coordinate_plane_iterate(plane, chunk);
+		trace_events_poll();
+		coordinate_plane_metrics_update(metrics, plane, NULL);
+		uint64_t elapsed = time_in_usec() - before;
+		if (((2 * elapsed) < usec_per_chunk) && chunk < (UINT32_MAX / 2)) {
+			chunk *= 2;
+		}
+	}
+
+	if (output) {
+		FILE *out = fopen(output, "wb");
+		if (!out) {
+			die("could not open '%s' (%s)", output, strerror(errno));
+		}
+		size_t palette_len = 1024;
+		pixel_buffer_s *buf =
+		    pixel_buffer_new_from_plane(plane, palette_len);
+		uint64_t phase_start = coordinate_plane_time_in_nsec();
+		perf_counters_begin(perf_counters_phase_colourize);
+		pixel_buffer_update(plane, buf);
+		perf_counters_end(perf_counters_phase_colourize);
+		uint64_t colourized = coordinate_plane_time_in_nsec();
+		int err = pixel_buffer_write_ppm(buf, out);
+		if (fclose(out) || err) {
+			die("could not write '%s' (%s)", output,
+			    strerror(errno));
+		}
+		uint64_t presented = coordinate_plane_time_in_nsec();
+		coordinate_plane_stats_add_phase(plane,
+						 coordinate_plane_phase_colourize,
+						 colourized - phase_start);
+		coordinate_plane_stats_add_phase(plane,
+						 coordinate_plane_phase_present,
+						 presented - colourized);
+		pixel_buffer_free(buf);
+	} else {
+		fprint_coordinate_plane_ascii(stdout, plane);
+	}
+
+	print_phase_times(plane, stdout);
+	fprintf(stdout, "\n");
+	print_memory_usage(plane, NULL, stdout);
+	fprintf(stdout, "\n");
+	coordinate_plane_metrics_write(metrics, plane, NULL);
+
+	const char *title = coordinate_plane_function_name(plane);
+	uint64_t it_count = coordinate_plane_iteration_count(plane);
+	size_t escaped = coordinate_plane_escaped_count(plane);
+	size_t not_escaped = coordinate_plane_not_escaped_count(plane);
+	fprintf(stdout, "%s %" PRIu64 " escaped: %zu not: %zu\n", title,
+		it_count, escaped, not_escaped);
+}
+
+static void cli_write_heatmap(coordinate_plane_s *plane, const char *path)
+{
+	FILE *out = fopen(path, "wb");
+	if (!out) {
+		die("could not open '%s' (%s)", path, strerror(errno));
+	}
+	int err = coordinate_plane_write_heatmap_ppm(plane, out);
+	if (fclose(out) || err) {
+		die("could not write '%s' (%s)", path, strerror(errno));
+	}
+}
+
+static void cli_write_buddhabrot(buddhabrot_s *buddhabrot, const char *path)
+{
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+	FILE *out = fopen(tmp_path, "wb");
+	if (!out) {
+		die("could not open '%s' (%s)", tmp_path, strerror(errno));
+	}
+	int err = buddhabrot_write_ppm(buddhabrot, out);
+	if (fclose(out) || err) {
+		die("could not write '%s' (%s)", tmp_path, strerror(errno));
+	}
+	if (rename(tmp_path, path)) {
+		die("could not rename '%s' to '%s' (%s)", tmp_path, path,
+		    strerror(errno));
+	}
+}
+
+/* rounds double in size; the image is replaced after each, so it can
+   be watched as it refines, and stopping early still leaves a picture.
+   Only the view is taken from the plane, which is freed before sampling
+   so that neither its points nor its thread pool are held meanwhile */
+static void cli_buddhabrot(coordinate_plane_s *plane,
+			   const coord_options_s *options)
+{
+	if (!options->output) {
+		die("%s", "--buddhabrot requires --output");
+	}
+	if (coordinate_plane_function_expr_source(plane)) {
+		die("%s", "--buddhabrot does not take a --function_expr");
+	}
+	if (coordinate_plane_function_converges(plane)) {
+		die("--buddhabrot needs a function which escapes, not '%s'",
+		    coordinate_plane_function_name(plane));
+	}
+
+	buddhabrot_options_s bopts;
+	memset(&bopts, 0x00, sizeof(bopts));
+	bopts.width = coordinate_plane_win_width(plane);
+	bopts.height = coordinate_plane_win_height(plane);
+	bopts.x_min = coordinate_plane_x_min(plane);
+	bopts.x_max = coordinate_plane_x_max(plane);
+	bopts.y_min = coordinate_plane_y_min(plane);
+	bopts.y_max = coordinate_plane_y_max(plane);
+	bopts.pfuncs_idx = coordinate_plane_function_index(plane);
+	coordinate_plane_seed(plane, &bopts.seed);
+	uint64_t halt_after = coordinate_plane_halt_after(plane);
+	uint32_t limit = (halt_after && halt_after < UINT32_MAX) ?
+	    (uint32_t)halt_after : 1000;
+	if (options->nebula) {
+		bopts.channels = 3;
+		bopts.max_iterations[0] = limit;
+		bopts.max_iterations[1] = (limit >= 10) ? (limit / 10) : 1;
+		bopts.max_iterations[2] = (limit >= 100) ? (limit / 100) : 1;
+	} else {
+		bopts.channels = 1;
+		bopts.max_iterations[0] = limit;
+	}
+	bopts.importance = options->importance;
+	bopts.num_threads = coordinate_plane_num_threads(plane);
+	bopts.rng_seed = 1;
+	coordinate_plane_free(plane);
+
+	buddhabrot_s *buddhabrot = buddhabrot_new(&bopts);
+	if (!buddhabrot) {
+		die("%s", "could not start the buddhabrot");
+	}
+
+	uint64_t total = options->buddhabrot;
+	uint64_t round = 64 * 1024;
+	uint64_t start = time_in_usec();
+	buddhabrot_stats_s stats;
+	buddhabrot_stats(buddhabrot, &stats);
+	while (stats.samples < total) {
+		uint64_t remaining = total - stats.samples;
+		buddhabrot_sample(buddhabrot,
+				  (round < remaining) ? round : remaining);
+		trace_events_poll();
+		cli_write_buddhabrot(buddhabrot, options->output);
+		buddhabrot_stats(buddhabrot, &stats);
+		double sec = (time_in_usec() - start) / (1000.0 * 1000.0);
+		fprintf(stdout, "round %" PRIu64 ": samples: %" PRIu64
+			" orbits: %" PRIu64 " points: %" PRIu64
+			" (%.0f samples/sec)\n", stats.rounds, stats.samples,
+			stats.orbits, stats.points,
+			(sec > 0.0) ? (stats.samples / sec) : 0.0);
+		fflush(stdout);
+		round *= 2;
+	}
+
+	buddhabrot_free(buddhabrot);
+}
+
+static struct termios term_orig;
+static int term_is_raw = 0;
+static volatile sig_atomic_t term_resized = 0;
+static volatile sig_atomic_t term_interrupted = 0;
+
+static void term_sigwinch_handler(int sig)
+{
+	(void)sig;
+	term_resized = 1;
+}
+
+static void term_interrupt_handler(int sig)
+{
+	(void)sig;
+	term_interrupted = 1;
+}
+
+static void term_restore(void)
+{
+	if (!term_is_raw) {
+		return;
+	}
+	/* reset colors, show the cursor, leave the alternate screen */
+	fprintf(stdout, "\033[0m\033[?25h\033[?1049l");
+	fflush(stdout);
+	tcsetattr(STDIN_FILENO, TCSANOW, &term_orig);
+	term_is_raw = 0;
+}
+
+/* VMIN=0 VTIME=0 makes read() return at once with whatever is pending;
+   O_NONBLOCK is avoided as the tty description is shared with stdout */
+static void term_raw_mode(void)
+{
+	if (tcgetattr(STDIN_FILENO, &term_orig)) {
+		die("tcgetattr(STDIN_FILENO) failed (%s)", strerror(errno));
+	}
+	struct termios raw = term_orig;
+	raw.c_iflag &= ~(IXON | ICRNL);
+	raw.c_lflag &= ~(ICANON | ECHO);
+	raw.c_cc[VMIN] = 0;
+	raw.c_cc[VTIME] = 0;
+	if (tcsetattr(STDIN_FILENO, TCSANOW, &raw)) {
+		die("tcsetattr(STDIN_FILENO) failed (%s)", strerror(errno));
+	}
+	term_is_raw = 1;
+	atexit(term_restore);
+
+	signal(SIGWINCH, term_sigwinch_handler);
+	signal(SIGINT, term_interrupt_handler);
+	signal(SIGTERM, term_interrupt_handler);
+
+	/* alternate screen, hide the cursor, clear */
+	fprintf(stdout, "\033[?1049h\033[?25l\033[H\033[J");
+	fflush(stdout);
+}
+
+static void term_size(uint32_t *cols, uint32_t *rows)
+{
+	struct winsize ws;
+	if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) || !ws.ws_col || !ws.ws_row) {
+		*cols = 80;
+		*rows = 24;
+		return;
+	}
+	*cols = ws.ws_col;
+	*rows = ws.ws_row;
+}
+
+/*
+ An escape sequence may be split across reads, as over ssh or a slow
+ tty, so an incomplete one is kept for the next read; only once no more
+ has come within term_escape_usec is a lone ESC taken as the key.
+*/
+#define term_escape_usec (50 * 1000)
+#define term_pending_max 8
+static unsigned char term_pending[term_pending_max];
+static size_t term_pending_len = 0;
+static uint64_t term_pending_usec = 0;
+
+static keyboard_key_s *term_key(human_input_s *input, unsigned char c)
+{
+	switch (c) {
+	case '\033':
+		return &input->esc;
+	case ' ':
+	case 'j':
+		return &input->space;
+	case 'w':
+		return &input->w;
+	case 'a':
+		return &input->a;
+	case 's':
+		return &input->s;
+	case 'd':
+		return &input->d;
+	case 'z':
+		return &input->z;
+	case 'x':
+		return &input->x;
+	case 'h':
+		return &input->h;
+	case 'm':
+		return &input->m;
+	case 'n':
+		return &input->n;
+	case 'q':
+		return &input->q;
+	}
+	return NULL;
+}
+
+/* the key of a complete "ESC [ digits final" sequence, if any */
+static keyboard_key_s *term_escape_key(human_input_s *input,
+				       const unsigned char *digits,
+				       size_t digits_len, unsigned char final)
+{
+	if (!digits_len) {
+		switch (final) {
+		case 'A':
+			return &input->up;
+		case 'B':
+			return &input->down;
+		case 'C':
+			return &input->right;
+		case 'D':
+			return &input->left;
+		}
+		return NULL;
+	}
+	if (final != '~' || digits_len != 1) {
+		return NULL;
+	}
+	switch (digits[0]) {
+	case '5':
+		return &input->page_up;
+	case '6':
+		return &input->page_down;
+	}
+	return NULL;
+}
+
+static void term_press(keyboard_key_s *key)
+{
+	if (key) {
+		/* terminals send presses only, never releases */
+		key->is_down = 1;
+		key->was_down = 0;
+	}
+}
+
+/* waits up to timeout_usec for a key, then drains all pending bytes */
+static void term_read_input(human_input_s *input, uint64_t timeout_usec)
+{
+	if (term_pending_len) {
+		uint64_t waited = time_in_usec() - term_pending_usec;
+		uint64_t left = (waited < term_escape_usec) ?
+		    (term_escape_usec - waited) : 0;
+		if (timeout_usec > left) {
+			timeout_usec = left;
+		}
+	}
+
+	struct pollfd pfd = { STDIN_FILENO, POLLIN, 0 };
+	if (poll(&pfd, 1, (int)(timeout_usec / 1000)) <= 0) {
+		uint64_t waited = time_in_usec() - term_pending_usec;
+		if (term_pending_len && waited >= term_escape_usec) {
+			/* nothing followed: it was the ESC key after all */
+			term_press(&input->esc);
+			term_pending_len = 0;
+		}
+		return;
+	}
+
+	unsigned char buf[term_pending_max + 64];
+	memcpy(buf, term_pending, term_pending_len);
+	ssize_t got = read(STDIN_FILENO, buf + term_pending_len, 64);
+	size_t len = term_pending_len + ((got > 0) ? (size_t)got : 0);
+	term_pending_len = 0;
+
+	for (size_t i = 0; i < len; ++i) {
+		if (buf[i] != '\033') {
+			term_press(term_key(input, buf[i]));
+			continue;
+		}
+		if ((i + 1) < len && buf[i + 1] != '[') {
+			term_press(&input->esc);
+			continue;
+		}
+		size_t final = i + 2;
+		while (final < len && buf[final] >= '0' && buf[final] <= '9') {
+			++final;
+		}
+		if (final >= len) {
+			if ((len - i) <= term_pending_max) {
+				memcpy(term_pending, buf + i, len - i);
+				term_pending_len = len - i;
+				term_pending_usec = time_in_usec();
+			}
+			return;
+		}
+		term_press(term_escape_key(input, buf + i + 2, final - (i + 2),
+					   buf[final]));
+		i = final;
+	}
+}
+
+typedef struct truecolor_screen {
+	uint32_t cols;
+	uint32_t rows;
+	/* the pixels as last written to the terminal */
+	uint32_t *shown;
+	size_t shown_len;
+	char *out;
+	size_t out_size;
+} truecolor_screen_s;
+
+static void truecolor_screen_resize(truecolor_screen_s *screen,
+				    uint32_t cols, uint32_t rows)
+{
+	free(screen->shown);
+	free(screen->out);
+
+	screen->cols = cols;
+	screen->rows = rows;
+	screen->shown_len = 2 * (size_t)cols * rows;
+	size_t size = sizeof(uint32_t) * screen->shown_len;
+	alloc_or_die(&screen->shown, size);
+	/* no rgb24 has the high byte set, so all cells will be drawn */
+	memset(screen->shown, 0xFF, size);
+
+	/* worst case: cursor move, both colors, and the glyph per cell */
+	screen->out_size = (64 * (size_t)cols * rows) + 256;
+	alloc_or_die(&screen->out, screen->out_size);
+}
+
+static size_t sgr_rgb(char *out, int layer, uint32_t rgb)
+{
+	return sprintf(out, "\033[%d;2;%u;%u;%um", layer,
+		       (unsigned)((rgb >> 16) & 0xFF),
+		       (unsigned)((rgb >> 8) & 0xFF), (unsigned)(rgb & 0xFF));
+}
+
+/* each cell is an upper-half-block: foreground is the top pixel,
+   background is the bottom pixel; only changed cells are written */
+static void truecolor_screen_draw(truecolor_screen_s *screen,
+				  pixel_buffer_s *buf, FILE *out)
+{
+	char *pos = screen->out;
+	uint32_t fg = UINT32_MAX;
+	uint32_t bg = UINT32_MAX;
+	uint32_t cur_row = UINT32_MAX;
+	uint32_t cur_col = UINT32_MAX;
+
+	for (uint32_t row = 0; row < screen->rows; ++row) {
+		uint32_t y0 = 2 * row;
+		uint32_t y1 = y0 + 1;
+		for (uint32_t col = 0; col < screen->cols; ++col) {
+			uint32_t top = 0;
+			uint32_t bottom = 0;
+			if (col < buf->width && y0 < buf->height) {
+				top = buf->pixels[(y0 * buf->width) + col];
+			}
+			if (col < buf->width && y1 < buf->height) {
+				bottom = buf->pixels[(y1 * buf->width) + col];
+			}
+			uint32_t *shown = screen->shown +
+			    (2 * (((size_t)row * screen->cols) + col));
+			if (shown[0] == top && shown[1] == bottom) {
+				continue;
+			}
+			shown[0] = top;
+			shown[1] = bottom;
+
+			if (cur_row != row || cur_col != col) {
+				pos += sprintf(pos, "\033[%" PRIu32 ";%"
+					       PRIu32 "H", row + 1, col + 1);
+			}
+			if (fg != top) {
+				pos += sgr_rgb(pos, 38, top);
+				fg = top;
+			}
+			if (bg != bottom) {
+				pos += sgr_rgb(pos, 48, bottom);
+				bg = bottom;
+			}
+			/* U+2580 UPPER HALF BLOCK */
+			pos += sprintf(pos, "\xE2\x96\x80");
+			cur_row = row;
+			cur_col = col + 1;
+		}
+	}
+	if (pos != screen->out) {
+		pos += sprintf(pos, "\033[0m");
+		fwrite(screen->out, 1, pos - screen->out, out);
+	}
+}
+
+static void truecolor_fit_to_terminal(coordinate_plane_s *plane,
+				      pixel_buffer_s *buf,
+				      truecolor_screen_s *screen)
+{
+	uint32_t cols, rows;
+	term_size(&cols, &rows);
+	/* leave the last line for the status */
+	rows = (rows > 1) ? (rows - 1) : 1;
+
+	bool preserve_ratio = false;
+	coordinate_plane_resize(plane, cols, 2 * rows, preserve_ratio);
+	pixel_buffer_resize(buf, 2 * rows, cols);
+	truecolor_screen_resize(screen, cols, rows);
+
+	fprintf(stdout, "\033[0m\033[H\033[J");
+}
+
+void cli_truecolor_iteration(coordinate_plane_s *plane, uint32_t fps,
+			     coordinate_plane_metrics_s *metrics)
+{
+	size_t palette_len = 1024;
+	pixel_buffer_s *buf = pixel_buffer_new_from_plane(plane, palette_len);
+
+	truecolor_screen_s screen;
+	memset(&screen, 0x00, sizeof(truecolor_screen_s));
+
+	term_raw_mode();
+	truecolor_fit_to_terminal(plane, buf, &screen);
+
+	frame_pacer_s pacer;
+	frame_pacer_init(&pacer, fps);
+	uint64_t usec_per_sec = (1000 * 1000);
+	uint64_t usec_per_frame = pacer.target_usec;
+	uint32_t it_per_frame = pacer.it_per_frame;
+	uint64_t last_print = 0;
+	uint64_t frames_since_print = 0;
+	uint64_t iterations_at_last_print = 0;
+	double fps_measured = 0.0;
+	double ips = 0.0;
+
+	human_input_s input;
+	uint64_t last_frame = coordinate_plane_time_in_nsec();
+	uint64_t frame_start = time_in_usec();
+	last_print = frame_start;
+	int halt = 0;
+	while (!halt && !term_interrupted) {
+		human_input_init(&input);
+		uint64_t now = time_in_usec();
+		uint64_t deadline = frame_start + usec_per_frame;
+		term_read_input(&input, (deadline > now) ? (deadline - now) : 0);
+		frame_start = time_in_usec();
+
+		enum coordinate_plane_change change =
+		    human_input_process(&input, plane);
+		if (change == coordinate_plane_change_shutdown) {
+			break;
+		}
+		if (term_resized) {
+			term_resized = 0;
+			truecolor_fit_to_terminal(plane, buf, &screen);
+			change = coordinate_plane_change_yes;
+		}
+		if (change == coordinate_plane_change_yes) {
+			frame_pacer_reset(&pacer);
+			it_per_frame = pacer.it_per_frame;
+			iterations_at_last_print = 0;
+		}
+
+		uint64_t before = time_in_usec();
+		uint64_t it_before = coordinate_plane_iteration_count(plane);
+		coordinate_plane_iterate(plane, it_per_frame);
+		uint64_t computed = time_in_usec();
+
+		uint64_t it_count = coordinate_plane_iteration_count(plane);
+		uint64_t halt_after = coordinate_plane_halt_after(plane);
+		if (halt_after && it_count >= halt_after) {
+			halt = 1;
+		}
+
+		uint64_t phase_start = coordinate_plane_time_in_nsec();
+		perf_counters_begin(perf_counters_phase_colourize);
+		pixel_buffer_update(plane, buf);
+		perf_counters_end(perf_counters_phase_colourize);
+		uint64_t colourized = coordinate_plane_time_in_nsec();
+		truecolor_screen_draw(&screen, buf, stdout);
+		uint64_t uploaded = coordinate_plane_time_in_nsec();
+		fflush(stdout);
+		uint64_t presented = coordinate_plane_time_in_nsec();
+		coordinate_plane_stats_add_phase(plane,
+						 coordinate_plane_phase_colourize,
+						 colourized - phase_start);
+		coordinate_plane_stats_add_phase(plane,
+						 coordinate_plane_phase_upload,
+						 uploaded - colourized);
+		coordinate_plane_stats_add_phase(plane,
+						 coordinate_plane_phase_present,
+						 presented - uploaded);
+		coordinate_plane_stats_add_frame(plane, presented - last_frame);
+		trace_event_complete("colourize", phase_start, colourized);
+		trace_event_complete("upload", colourized, uploaded);
+		trace_event_complete("present", uploaded, presented);
+		trace_events_poll();
+		coordinate_plane_metrics_update(metrics, plane, buf);
+		last_frame = presented;
+		++frames_since_print;
+
+		now = time_in_usec();
+		it_per_frame = frame_pacer_update(&pacer, it_count - it_before,
+						  computed - before,
+						  now - computed);
+
+		uint64_t elapsed = now - last_print;
+		if (elapsed > (usec_per_sec / 2)) {
+			double seconds = (1.0 * elapsed) / usec_per_sec;
+			fps_measured = frames_since_print / seconds;
+			uint64_t it_diff = it_count - iterations_at_last_print;
+			ips = it_diff / seconds;
+			frames_since_print = 0;
+			iterations_at_last_print = it_count;
+			last_print = now;
+		}
+		fprintf(stdout, "\033[%" PRIu32 ";1H\033[0m\033[K"
+			"%s i:%" PRIu64 " escaped: %zu not: %zu"
+			" (ips: %.f fps: %.f ipf: %" PRIu32 " thds: %zu)",
+			screen.rows + 1, coordinate_plane_function_name(plane),
+			it_count, coordinate_plane_escaped_count(plane),
+			coordinate_plane_not_escaped_count(plane), ips,
+			fps_measured, it_per_frame,
+			coordinate_plane_num_threads(plane));
+		fflush(stdout);
+	}
+
+	term_restore();
+	print_command_line(plane, stdout);
+	print_phase_times(plane, stdout);
+	fprintf(stdout, "\n");
+	print_memory_usage(plane, buf, stdout);
+	fprintf(stdout, "\n");
+	coordinate_plane_metrics_write(metrics, plane, buf);
+
+	if (Make_valgrind_happy) {
+		free(screen.shown);
+		free(screen.out);
+		pixel_buffer_free(buf);
+	}
+}
+
+int main(int argc, char **argv)
+{
+	signal(SIGSEGV, backtrace_exit_handler);
+
+	const char *version = CLI_COORD_PLANE_ITERATION_VERSION;
+	coord_options_s options;
+	coordinate_plane_s *plane =
+	    coordinate_plane_new_from_args(argc, argv, version, &options);
+
+	if (options.buddhabrot) {
+		cli_buddhabrot(plane, &options);
+		return 0;
+	}
+
+	if (options.heatmap) {
+		coordinate_plane_record_costs(plane, true);
+	}
+
+	coordinate_plane_metrics_s metrics;
+	if (coordinate_plane_metrics_init(&metrics, options.metrics,
+					  options.metrics_csv,
+					  options.metrics_interval)) {
+		die("%s", "could not start metrics");
+	}
+
+	if (options.batch) {
+		cli_batch_iteration(plane, options.output, &metrics);
+	} else if (options.truecolor) {
+		cli_truecolor_iteration(plane, options.fps, &metrics);
+	} else {
+		cli_ascii_iteration(plane);
+		coordinate_plane_metrics_write(&metrics, plane, NULL);
+	}
+	coordinate_plane_metrics_close(&metrics);
+
+	if (options.heatmap) {
+		cli_write_heatmap(plane, options.heatmap);
+	}
 
 	if (Make_valgrind_happy) {
 		coordinate_plane_free(plane);
@@ -0,0 +1,489 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* coord-plane-buddhabrot.c: orbit density ("Buddhabrot") rendering */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#include <assert.h>
+#include <inttypes.h>
+#include <math.h>
+#include <string.h>
+
+#ifndef SKIP_THREADS
+#include <unistd.h>
+#include <basic-thread-pool.h>
+#endif
+
+#include <alloc-or-die.h>
+#include <coord-plane-buddhabrot.h>
+
+/*
+ The sampled square is cut into strata_side * strata_side strata. With
+ uniform sampling, sample i goes to stratum (i % strata_len), jittered
+ within it, so every stratum is covered evenly. With importance, the
+ stratum is chosen in proportion to the orbit points it has produced
+ so far, mixed half and half with uniform so that no stratum is ever
+ starved; each orbit is then weighted by uniform / chosen probability,
+ so the density converges to the same image, only sooner.
+*/
+#define buddhabrot_strata_side 128
+#define buddhabrot_strata_len (buddhabrot_strata_side * buddhabrot_strata_side)
+#define buddhabrot_sample_radius 2.0L
+
+typedef struct buddhabrot_worker {
+	buddhabrot_s *buddhabrot;
+	double *density;
+	uint64_t *stratum_points;
+	uint64_t *stratum_samples;
+	uint64_t rng;
+	uint64_t first;
+	uint64_t samples;
+	uint64_t orbits;
+	uint64_t points;
+	uint32_t row_begin;
+	uint32_t row_end;
+} buddhabrot_worker_s;
+
+struct buddhabrot {
+	buddhabrot_options_s opts;
+	const named_pfunc_s *named;
+	uint32_t max_iterations;
+	size_t pixels_len;
+	long double x_scale;
+	long double y_scale;
+	double *density;
+
+	uint64_t *stratum_points;
+	uint64_t *stratum_samples;
+	double *stratum_cdf;
+	double *stratum_weight;
+	bool importance_ready;
+
+	uint32_t num_threads;
+	buddhabrot_worker_s *workers;
+#ifndef SKIP_THREADS
+	basic_thread_pool_s *tpool;
+#endif
+	buddhabrot_stats_s stats;
+};
+
+typedef int (*buddhabrot_worker_f)(void *arg);
+
+static uint64_t buddhabrot_rng_next(uint64_t *state)
+{
+	/* splitmix64 */
+	uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+/* in [0, 1) */
+static double buddhabrot_rng_double(uint64_t *state)
+{
+	return (buddhabrot_rng_next(state) >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/* the main cardioid and the period two bulb never escape */
+static bool mandlebrot_known_interior(ldxy_s c)
+{
+	long double x = c.x - 0.25L;
+	long double y2 = c.y * c.y;
+	long double q = (x * x) + y2;
+	if ((q * (q + x)) <= (0.25L * y2)) {
+		return true;
+	}
+	long double x1 = c.x + 1.0L;
+	return ((x1 * x1) + y2) <= (1.0L / 16.0L);
+}
+
+static size_t buddhabrot_pick_stratum(buddhabrot_s *b, uint64_t *rng,
+				      uint64_t i)
+{
+	if (!b->importance_ready) {
+		return i % buddhabrot_strata_len;
+	}
+	double u = buddhabrot_rng_double(rng);
+	size_t lo = 0;
+	size_t hi = buddhabrot_strata_len - 1;
+	while (lo < hi) {
+		size_t mid = lo + ((hi - lo) / 2);
+		if (b->stratum_cdf[mid] > u) {
+			hi = mid;
+		} else {
+			lo = mid + 1;
+		}
+	}
+	return lo;
+}
+
+/* returns the steps before escape, or zero if it did not escape */
+static uint32_t buddhabrot_escape_steps(buddhabrot_s *b, ldxy_s xy)
+{
+	const named_pfunc_s *named = b->named;
+	iterxy_s p;
+	named->pfunc_init(&p, xy, b->opts.seed);
+	for (uint32_t n = 0; n < b->max_iterations; ++n) {
+		if (named->pfunc_escape(p.z)) {
+			return n;
+		}
+		named->pfunc(&p);
+	}
+	return 0;
+}
+
+/* second pass: the same orbit again, drawn into the density */
+static uint64_t buddhabrot_draw_orbit(buddhabrot_s *b, double *density,
+				      ldxy_s xy, uint32_t steps, double weight)
+{
+	const named_pfunc_s *named = b->named;
+	uint32_t width = b->opts.width;
+	uint32_t height = b->opts.height;
+
+	double *channels[buddhabrot_max_channels];
+	uint32_t channels_len = 0;
+	for (uint32_t ch = 0; ch < b->opts.channels; ++ch) {
+		if (steps <= b->opts.max_iterations[ch]) {
+			double *d = density + (ch * b->pixels_len);
+			channels[channels_len++] = d;
+		}
+	}
+
+	uint64_t drawn = 0;
+	iterxy_s p;
+	named->pfunc_init(&p, xy, b->opts.seed);
+	for (uint32_t n = 0; n < steps; ++n) {
+		named->pfunc(&p);
+		long double px = (p.z.x - b->opts.x_min) * b->x_scale;
+		long double py = (b->opts.y_max - p.z.y) * b->y_scale;
+		if (!(px >= 0.0L && px < width && py >= 0.0L && py < height)) {
+			continue;
+		}
+		size_t i = ((size_t)py * width) + (size_t)px;
+		for (uint32_t c = 0; c < channels_len; ++c) {
+			channels[c][i] += weight;
+		}
+		++drawn;
+	}
+	return drawn;
+}
+
+static int buddhabrot_sample_worker(void *arg)
+{
+	buddhabrot_worker_s *w = arg;
+	buddhabrot_s *b = w->buddhabrot;
+	bool is_mandlebrot = (b->opts.pfuncs_idx == pfuncs_mandlebrot_idx);
+	long double r = buddhabrot_sample_radius;
+	long double stratum_size = (2.0L * r) / buddhabrot_strata_side;
+
+	for (uint64_t i = 0; i < w->samples; ++i) {
+		size_t s = buddhabrot_pick_stratum(b, &w->rng, w->first + i);
+		double weight =
+		    b->importance_ready ? b->stratum_weight[s] : 1.0;
+		size_t sx = s % buddhabrot_strata_side;
+		size_t sy = s / buddhabrot_strata_side;
+		ldxy_s xy;
+		double jitter_x = buddhabrot_rng_double(&w->rng);
+		double jitter_y = buddhabrot_rng_double(&w->rng);
+		xy.x = -r + (stratum_size * (sx + jitter_x));
+		xy.y = -r + (stratum_size * (sy + jitter_y));
+
+		++w->stratum_samples[s];
+		if (is_mandlebrot && mandlebrot_known_interior(xy)) {
+			continue;
+		}
+		uint32_t steps = buddhabrot_escape_steps(b, xy);
+		if (!steps) {
+			continue;
+		}
+		++w->orbits;
+		w->stratum_points[s] += steps;
+		w->points += buddhabrot_draw_orbit(b, w->density, xy, steps,
+						   weight);
+	}
+	return 0;
+}
+
+/* each worker adds its own band of rows from every histogram */
+static int buddhabrot_merge_worker(void *arg)
+{
+	buddhabrot_worker_s *w = arg;
+	buddhabrot_s *b = w->buddhabrot;
+	size_t width = b->opts.width;
+	size_t begin = w->row_begin * width;
+	size_t len = (w->row_end - w->row_begin) * width;
+	for (uint32_t ch = 0; ch < b->opts.channels; ++ch) {
+		double *to = b->density + (ch * b->pixels_len) + begin;
+		for (uint32_t t = 0; t < b->num_threads; ++t) {
+			double *from = b->workers[t].density +
+			    (ch * b->pixels_len) + begin;
+			for (size_t i = 0; i < len; ++i) {
+				to[i] += from[i];
+			}
+			memset(from, 0x00, len * sizeof(double));
+		}
+	}
+	return 0;
+}
+
+static void buddhabrot_run_workers(buddhabrot_s *b,
+				   buddhabrot_worker_f func)
+{
+#ifndef SKIP_THREADS
+	for (uint32_t t = 0; t < b->num_threads; ++t) {
+		if (basic_thread_pool_add(b->tpool, func, b->workers + t)) {
+			func(b->workers + t);
+		}
+	}
+	basic_thread_pool_wait(b->tpool);
+#else
+	for (uint32_t t = 0; t < b->num_threads; ++t) {
+		func(b->workers + t);
+	}
+#endif
+}
+
+/* mean orbit length of each stratum, as its share of the samples */
+static void buddhabrot_update_importance(buddhabrot_s *b)
+{
+	double total = 0.0;
+	for (size_t s = 0; s < buddhabrot_strata_len; ++s) {
+		uint64_t samples = b->stratum_samples[s];
+		double mean = samples ? (1.0 * b->stratum_points[s] / samples) :
+		    0.0;
+		b->stratum_weight[s] = mean;
+		total += mean;
+	}
+	if (!(total > 0.0)) {
+		b->importance_ready = false;
+		return;
+	}
+
+	double uniform = 1.0 / buddhabrot_strata_len;
+	double cumulative = 0.0;
+	for (size_t s = 0; s < buddhabrot_strata_len; ++s) {
+		double share = b->stratum_weight[s] / total;
+		double p = (0.5 * uniform) + (0.5 * share);
+		cumulative += p;
+		b->stratum_cdf[s] = cumulative;
+		b->stratum_weight[s] = uniform / p;
+	}
+	b->stratum_cdf[buddhabrot_strata_len - 1] = 1.0;
+	b->importance_ready = true;
+}
+
+void buddhabrot_sample(buddhabrot_s *b, uint64_t samples)
+{
+	assert(b);
+	if (!samples) {
+		return;
+	}
+
+	uint64_t per_thread = samples / b->num_threads;
+	uint64_t remainder = samples % b->num_threads;
+	uint64_t first = b->stats.samples;
+	for (uint32_t t = 0; t < b->num_threads; ++t) {
+		buddhabrot_worker_s *w = b->workers + t;
+		w->samples = per_thread + ((t < remainder) ? 1 : 0);
+		w->first = first;
+		first += w->samples;
+		w->orbits = 0;
+		w->points = 0;
+		w->rng = b->opts.rng_seed ^
+		    (0xD1B54A32D192ED03ULL * (b->stats.rounds + 1)) ^ t;
+	}
+	buddhabrot_run_workers(b, buddhabrot_sample_worker);
+	buddhabrot_run_workers(b, buddhabrot_merge_worker);
+
+	for (uint32_t t = 0; t < b->num_threads; ++t) {
+		buddhabrot_worker_s *w = b->workers + t;
+		for (size_t s = 0; s < buddhabrot_strata_len; ++s) {
+			b->stratum_points[s] += w->stratum_points[s];
+			b->stratum_samples[s] += w->stratum_samples[s];
+		}
+		memset(w->stratum_points, 0x00,
+		       buddhabrot_strata_len * sizeof(uint64_t));
+		memset(w->stratum_samples, 0x00,
+		       buddhabrot_strata_len * sizeof(uint64_t));
+		b->stats.orbits += w->orbits;
+		b->stats.points += w->points;
+	}
+	b->stats.samples += samples;
+	++b->stats.rounds;
+
+	if (b->opts.importance) {
+		buddhabrot_update_importance(b);
+	}
+}
+
+static int buddhabrot_options_invalid(const buddhabrot_options_s *opts)
+{
+	if (!opts || !opts->width || !opts->height) {
+		return 1;
+	}
+	if (opts->pfuncs_idx >= pfuncs_len) {
+		return 1;
+	}
+	if (pfuncs[opts->pfuncs_idx].pfunc_root) {
+		/* it stops on converging, so has no escaping orbits to draw */
+		return 1;
+	}
+	if (!opts->channels || opts->channels > buddhabrot_max_channels) {
+		return 1;
+	}
+	for (uint32_t ch = 0; ch < opts->channels; ++ch) {
+		if (!opts->max_iterations[ch]) {
+			return 1;
+		}
+	}
+	if (!(opts->x_max > opts->x_min) || !(opts->y_max > opts->y_min)) {
+		return 1;
+	}
+	return 0;
+}
+
+buddhabrot_s *buddhabrot_new(const buddhabrot_options_s *options)
+{
+	if (buddhabrot_options_invalid(options)) {
+		return NULL;
+	}
+
+	buddhabrot_s *b = NULL;
+	size_t size = sizeof(buddhabrot_s);
+	alloc_or_die(&b, size);
+	memset(b, 0x00, size);
+
+	b->opts = *options;
+	b->named = pfuncs + options->pfuncs_idx;
+	for (uint32_t ch = 0; ch < options->channels; ++ch) {
+		if (options->max_iterations[ch] > b->max_iterations) {
+			b->max_iterations = options->max_iterations[ch];
+		}
+	}
+	b->pixels_len = (size_t)options->width * options->height;
+	b->x_scale = options->width / (options->x_max - options->x_min);
+	b->y_scale = options->height / (options->y_max - options->y_min);
+
+	size_t density_size = options->channels * b->pixels_len *
+	    sizeof(double);
+	size_t strata_u64_size = buddhabrot_strata_len * sizeof(uint64_t);
+	size_t strata_double_size = buddhabrot_strata_len * sizeof(double);
+	calloc_or_die(&b->density, 1, density_size);
+	calloc_or_die(&b->stratum_points, 1, strata_u64_size);
+	calloc_or_die(&b->stratum_samples, 1, strata_u64_size);
+	calloc_or_die(&b->stratum_cdf, 1, strata_double_size);
+	calloc_or_die(&b->stratum_weight, 1, strata_double_size);
+
+	uint32_t num_threads = options->num_threads;
+#ifndef SKIP_THREADS
+	if (!num_threads) {
+		long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = (nproc > 0) ? (uint32_t)nproc : 1;
+	}
+	b->tpool = basic_thread_pool_new(num_threads);
+	if (!b->tpool) {
+		buddhabrot_free(b);
+		return NULL;
+	}
+#else
+	num_threads = 1;
+#endif
+	/* every worker merges at least one row */
+	if (num_threads > options->height) {
+		num_threads = options->height;
+	}
+	b->num_threads = num_threads;
+
+	calloc_or_die(&b->workers, num_threads, sizeof(buddhabrot_worker_s));
+	uint32_t rows_per_thread = options->height / num_threads;
+	uint32_t extra_rows = options->height % num_threads;
+	uint32_t row = 0;
+	for (uint32_t t = 0; t < num_threads; ++t) {
+		buddhabrot_worker_s *w = b->workers + t;
+		w->buddhabrot = b;
+		calloc_or_die(&w->density, 1, density_size);
+		calloc_or_die(&w->stratum_points, 1, strata_u64_size);
+		calloc_or_die(&w->stratum_samples, 1, strata_u64_size);
+		w->row_begin = row;
+		row += rows_per_thread + ((t < extra_rows) ? 1 : 0);
+		w->row_end = row;
+	}
+
+	return b;
+}
+
+void buddhabrot_free(buddhabrot_s *b)
+{
+	if (!b) {
+		return;
+	}
+#ifndef SKIP_THREADS
+	if (b->tpool) {
+		basic_thread_pool_stop_and_free(&(b->tpool));
+	}
+#endif
+	if (b->workers) {
+		for (uint32_t t = 0; t < b->num_threads; ++t) {
+			free(b->workers[t].density);
+			free(b->workers[t].stratum_points);
+			free(b->workers[t].stratum_samples);
+		}
+		free(b->workers);
+	}
+	free(b->stratum_weight);
+	free(b->stratum_cdf);
+	free(b->stratum_samples);
+	free(b->stratum_points);
+	free(b->density);
+	free(b);
+}
+
+void buddhabrot_stats(buddhabrot_s *b, buddhabrot_stats_s *out)
+{
+	*out = b->stats;
+}
+
+const double *buddhabrot_density(buddhabrot_s *b, uint32_t channel)
+{
+	if (channel >= b->opts.channels) {
+		return NULL;
+	}
+	return b->density + (channel * b->pixels_len);
+}
+
+/* a square root curve, so the faint orbits still show */
+static unsigned char buddhabrot_tone(double density, double max)
+{
+	if (!(max > 0.0)) {
+		return 0;
+	}
+	double v = sqrt(density / max);
+	return (unsigned char)((v >= 1.0) ? 255 : (255.0 * v));
+}
+
+int buddhabrot_write_ppm(buddhabrot_s *b, FILE *out)
+{
+	double max[buddhabrot_max_channels] = { 0.0, 0.0, 0.0 };
+	for (uint32_t ch = 0; ch < b->opts.channels; ++ch) {
+		const double *d = b->density + (ch * b->pixels_len);
+		for (size_t i = 0; i < b->pixels_len; ++i) {
+			if (d[i] > max[ch]) {
+				max[ch] = d[i];
+			}
+		}
+	}
+
+	fprintf(out, "P6\n%" PRIu32 " %" PRIu32 "\n255\n", b->opts.width,
+		b->opts.height);
+	for (size_t i = 0; i < b->pixels_len; ++i) {
+		unsigned char rgb[3];
+		for (uint32_t c = 0; c < 3; ++c) {
+			uint32_t ch = (b->opts.channels == 1) ? 0 : c;
+			double d = b->density[(ch * b->pixels_len) + i];
+			rgb[c] = buddhabrot_tone(d, max[ch]);
+		}
+		fputc(rgb[0], out);
+		fputc(rgb[1], out);
+		fputc(rgb[2], out);
+	}
+	return ferror(out) ? 1 : 0;
+}
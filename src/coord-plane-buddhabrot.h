@@ -0,0 +1,78 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* coord-plane-buddhabrot.h: orbit density ("Buddhabrot") rendering */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#ifndef COORD_PLANE_BUDDHABROT_H
+#define COORD_PLANE_BUDDHABROT_H 1
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <coord-plane-iteration.h>
+
+/*
+ Rather than colour each point by when it escaped, the orbit of every
+ escaping point is drawn: each z it visits adds to the density of the
+ pixel under it. Starting points are sampled from the square which
+ holds the radius 2 disk, not from the view, since orbits from outside
+ the view land inside it. A nebula ("Nebulabrot") has three channels,
+ each counting only the orbits which escaped within its own limit.
+
+ Sampling is done in rounds, each of which adds to the density so far,
+ so an image may be written after every round and it sharpens as more
+ rounds are added. Each thread draws into its own density histogram,
+ and after each round every thread merges a separate band of rows, so
+ the merge needs no locks.
+*/
+#define buddhabrot_max_channels 3
+
+struct buddhabrot;
+typedef struct buddhabrot buddhabrot_s;
+
+typedef struct buddhabrot_options {
+	uint32_t width;
+	uint32_t height;
+	long double x_min;
+	long double x_max;
+	long double y_min;
+	long double y_max;
+	size_t pfuncs_idx;
+	ldxy_s seed;
+	/* 1, or 3 for a nebula: red, green, blue */
+	uint32_t channels;
+	uint32_t max_iterations[buddhabrot_max_channels];
+	/* after the first round, sample more where the long orbits were */
+	bool importance;
+	/* zero means one per online processor */
+	uint32_t num_threads;
+	uint64_t rng_seed;
+} buddhabrot_options_s;
+
+typedef struct buddhabrot_stats {
+	uint64_t samples;
+	uint64_t orbits;
+	uint64_t points;
+	uint64_t rounds;
+} buddhabrot_stats_s;
+
+/* returns NULL if the options are not usable, as for a function which
+   stops on convergence rather than escape */
+buddhabrot_s *buddhabrot_new(const buddhabrot_options_s *options);
+
+void buddhabrot_free(buddhabrot_s *buddhabrot);
+
+/* one round: samples more starting points, adding to the density */
+void buddhabrot_sample(buddhabrot_s *buddhabrot, uint64_t samples);
+
+void buddhabrot_stats(buddhabrot_s *buddhabrot, buddhabrot_stats_s *out);
+
+/* width * height, row-major, of one channel */
+const double *buddhabrot_density(buddhabrot_s *buddhabrot, uint32_t channel);
+
+/* binary "P6" portable pixmap, grey for one channel; returns 0 on
+   success */
+int buddhabrot_write_ppm(buddhabrot_s *buddhabrot, FILE *out);
+
+#endif /* COORD_PLANE_BUDDHABROT_H */
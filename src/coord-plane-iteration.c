@@ -7,6 +7,7 @@
 #include <math.h>
 #include <stdbool.h>
 #include <string.h>
+#include <time.h>
 
 #ifndef SKIP_THREADS
 #include <stdatomic.h>
@@ -14,6 +15,9 @@
 #endif
 
 #include <alloc-or-die.h>
+#include <trace-events.h>
+#include <perf-counters.h>
+#include <function-expr.h>
 #include <coord-plane-iteration.h>
 
 /* the y is understood to contain an i, the sqrt(-1) */
@@ -39,6 +43,7 @@ static void iterxy_init_zero(iterxy_s *p, ldxy_s xy, ldxy_s seed)
 	p->z.x = 0.0;
 	p->z.y = 0.0;
 	p->escaped = 0;
+	p->root = 0;
 }
 
 static void iterxy_init_xy(iterxy_s *p, ldxy_s xy, ldxy_s seed)
@@ -49,6 +54,7 @@ static void iterxy_init_xy(iterxy_s *p, ldxy_s xy, ldxy_s seed)
 	p->z.x = xy.x;
 	p->z.y = xy.y;
 	p->escaped = 0;
+	p->root = 0;
 }
 
 static long double radius_squared(ldxy_s c)
@@ -85,6 +91,168 @@ static void julia(iterxy_s *p)
 	p->z.y = result.y + p->seed.y;
 }
 
+static void multiply_complex(ldxy_s *out, ldxy_s a, ldxy_s b)
+{
+	long double x = (a.x * b.x) - (a.y * b.y);
+	long double y = (a.x * b.y) + (a.y * b.x);
+	out->x = x;
+	out->y = y;
+}
+
+/*
+ raise_N(r, z): r holds z, and is raised to z^N by straight-line
+ multiplies, squaring where it can; the kernels paste their degree onto
+ raise_ so each gets its own unrolled power, with no loop or pow()
+*/
+#define raise_2(r, z) multiply_complex(&(r), (r), (r))
+#define raise_3(r, z) raise_2(r, z); multiply_complex(&(r), (r), (z))
+#define raise_4(r, z) raise_2(r, z); raise_2(r, z)
+#define raise_5(r, z) raise_4(r, z); multiply_complex(&(r), (r), (z))
+
+/*
+ Newton's method on z^n - 1: Z[n+1] = Z[n] - (Z^n - 1) / (n * Z^(n-1))
+ Each point starts at its own location and runs toward one of the n
+ roots of unity; it stops once within newton_epsilon of one. The
+ macro makes a kernel per degree, with Z^(n-1) unrolled by raise_.
+*/
+#define newton_epsilon 1e-6L
+#define newton_epsilon_squared (newton_epsilon * newton_epsilon)
+
+static const ldxy_s unity_roots_3[] = {
+	{ 1.0L, 0.0L },
+	{ -0.5L, 0.866025403784438646763723170752936183L },
+	{ -0.5L, -0.866025403784438646763723170752936183L }
+};
+
+static const ldxy_s unity_roots_4[] = {
+	{ 1.0L, 0.0L },
+	{ 0.0L, 1.0L },
+	{ -1.0L, 0.0L },
+	{ 0.0L, -1.0L }
+};
+
+static const ldxy_s unity_roots_5[] = {
+	{ 1.0L, 0.0L },
+	{ 0.309016994374947424102293417182819059L,
+	 0.951056516295153572116439333379382143L },
+	{ -0.809016994374947424102293417182819059L,
+	 0.587785252292473129185164221860123627L },
+	{ -0.809016994374947424102293417182819059L,
+	 -0.587785252292473129185164221860123627L },
+	{ 0.309016994374947424102293417182819059L,
+	 -0.951056516295153572116439333379382143L }
+};
+
+/* all roots of unity lie on the unit circle, which is cheap to check */
+static uint32_t unity_root_near(ldxy_s z, const ldxy_s *roots, uint32_t n)
+{
+	long double r2 = radius_squared(z);
+	if (fabsl(r2 - 1.0L) > (4.0L * newton_epsilon)) {
+		return 0;
+	}
+	for (uint32_t i = 0; i < n; ++i) {
+		ldxy_s d = { z.x - roots[i].x, z.y - roots[i].y };
+		if (radius_squared(d) < newton_epsilon_squared) {
+			return i + 1;
+		}
+	}
+	return 0;
+}
+
+#define Newton_roots_of_unity(n, n_minus_1) \
+static void newton_z##n##_minus_1(iterxy_s *p) \
+{ \
+	ldxy_s z_n_minus_1 = p->z; \
+	raise_##n_minus_1(z_n_minus_1, p->z); \
+	ldxy_s z_n; \
+	multiply_complex(&z_n, z_n_minus_1, p->z); \
+	long double num_x = z_n.x - 1.0L; \
+	long double num_y = z_n.y; \
+	long double den_x = n * z_n_minus_1.x; \
+	long double den_y = n * z_n_minus_1.y; \
+	long double den = (den_x * den_x) + (den_y * den_y); \
+	if (den == 0.0L) { \
+		/* the derivative is zero: stuck, never converges */ \
+		return; \
+	} \
+	p->z.x -= ((num_x * den_x) + (num_y * den_y)) / den; \
+	p->z.y -= ((num_y * den_x) - (num_x * den_y)) / den; \
+} \
+\
+static uint32_t newton_z##n##_root(ldxy_s z) \
+{ \
+	return unity_root_near(z, unity_roots_##n, n); \
+} \
+\
+static bool newton_z##n##_converged(ldxy_s z) \
+{ \
+	return newton_z##n##_root(z) ? true : false; \
+}
+
+Newton_roots_of_unity(3, 2)
+Newton_roots_of_unity(4, 3)
+Newton_roots_of_unity(5, 4)
+
+static ldxy_s fold_none(ldxy_s z)
+{
+	return z;
+}
+
+/* burning ship: the absolute value of each part, before the power */
+static ldxy_s fold_absolute(ldxy_s z)
+{
+	z.x = fabsl(z.x);
+	z.y = fabsl(z.y);
+	return z;
+}
+
+/* tricorn: the complex conjugate, before the power */
+static ldxy_s fold_conjugate(ldxy_s z)
+{
+	z.y = -z.y;
+	return z;
+}
+
+/*
+ Z[n+1] = fold(Z[n])^d + Orig, and the Julia form which adds the seed.
+ Each family is its own pair of kernels with d fixed at compile time,
+ the power unrolled by raise_d.
+*/
+#define Escape_time_family(family, d, fold) \
+static ldxy_s family##_power(ldxy_s z) \
+{ \
+	z = fold(z); \
+	ldxy_s result = z; \
+	raise_##d(result, z); \
+	return result; \
+} \
+\
+static void family(iterxy_s *p) \
+{ \
+	ldxy_s result = family##_power(p->z); \
+	p->z.x = result.x + p->c.x; \
+	p->z.y = result.y + p->c.y; \
+} \
+\
+static void family##_julia(iterxy_s *p) \
+{ \
+	ldxy_s result = family##_power(p->z); \
+	p->z.x = result.x + p->seed.x; \
+	p->z.y = result.y + p->seed.y; \
+}
+
+/*
+ Only the degrees raise_ can express are built in; degree 2 is the
+ mandlebrot itself. Each degree costs two entries in pfuncs[], and
+ shifts every --function number after it, so any other whole number
+ degree is left to a formula: --function_expr='z^d + c'
+*/
+Escape_time_family(multibrot_3, 3, fold_none)
+Escape_time_family(multibrot_4, 4, fold_none)
+Escape_time_family(multibrot_5, 5, fold_none)
+Escape_time_family(burning_ship, 2, fold_absolute)
+Escape_time_family(tricorn, 2, fold_conjugate)
+
 #ifdef INCLUDE_ALL_FUNCTIONS
 static void ordinary_square(iterxy_s *p)
 {
@@ -139,29 +307,53 @@ static void not_a_circle(iterxy_s *p)
 }
 #endif /* INCLUDE_ALL_FUNCTIONS */
 
-named_pfunc_s pfuncs[] = {
-	{ iterxy_init_zero, xy_radius_greater_than_2, mandlebrot,
+const named_pfunc_s pfuncs[] = {
+	{ iterxy_init_zero, xy_radius_greater_than_2, mandlebrot, NULL,
 	 "mandlebrot" },
-	{ iterxy_init_xy, xy_radius_greater_than_2, julia, "julia" },
+	{ iterxy_init_xy, xy_radius_greater_than_2, julia, NULL, "julia" },
+	{ iterxy_init_xy, newton_z3_converged, newton_z3_minus_1,
+	 newton_z3_root, "newton_z3_minus_1" },
+	{ iterxy_init_xy, newton_z4_converged, newton_z4_minus_1,
+	 newton_z4_root, "newton_z4_minus_1" },
+	{ iterxy_init_xy, newton_z5_converged, newton_z5_minus_1,
+	 newton_z5_root, "newton_z5_minus_1" },
+	{ iterxy_init_zero, xy_radius_greater_than_2, multibrot_3, NULL,
+	 "multibrot_3" },
+	{ iterxy_init_xy, xy_radius_greater_than_2, multibrot_3_julia, NULL,
+	 "multibrot_3_julia" },
+	{ iterxy_init_zero, xy_radius_greater_than_2, multibrot_4, NULL,
+	 "multibrot_4" },
+	{ iterxy_init_xy, xy_radius_greater_than_2, multibrot_4_julia, NULL,
+	 "multibrot_4_julia" },
+	{ iterxy_init_zero, xy_radius_greater_than_2, multibrot_5, NULL,
+	 "multibrot_5" },
+	{ iterxy_init_xy, xy_radius_greater_than_2, multibrot_5_julia, NULL,
+	 "multibrot_5_julia" },
+	{ iterxy_init_zero, xy_radius_greater_than_2, burning_ship, NULL,
+	 "burning_ship" },
+	{ iterxy_init_xy, xy_radius_greater_than_2, burning_ship_julia, NULL,
+	 "burning_ship_julia" },
+	{ iterxy_init_zero, xy_radius_greater_than_2, tricorn, NULL,
+	 "tricorn" },
+	{ iterxy_init_xy, xy_radius_greater_than_2, tricorn_julia, NULL,
+	 "tricorn_julia" },
 #ifdef INCLUDE_ALL_FUNCTIONS
-	{ iterxy_init_xy, xy_radius_greater_than_2, ordinary_square,
+	{ iterxy_init_xy, xy_radius_greater_than_2, ordinary_square, NULL,
 	 "ordinary_square" },
-	{ iterxy_init_xy, xy_radius_greater_than_2, not_a_circle,
+	{ iterxy_init_xy, xy_radius_greater_than_2, not_a_circle, NULL,
 	 "not_a_circle" },
 	{ iterxy_init_zero, xy_radius_greater_than_2,
-	 square_binomial_collapse_y2_add_orig,
-	 "square_binomial_collapse_y2_add_orig," },
+	 square_binomial_collapse_y2_add_orig, NULL,
+	 "square_binomial_collapse_y2_add_orig" },
 	{ iterxy_init_zero, xy_radius_greater_than_2,
-	 square_binomial_ignore_y2_add_orig,
-	 "square_binomial_ignore_y2_add_orig," }
+	 square_binomial_ignore_y2_add_orig, NULL,
+	 "square_binomial_ignore_y2_add_orig" }
 #endif /* INCLUDE_ALL_FUNCTIONS */
 };
 
-#ifdef INCLUDE_ALL_FUNCTIONS
-const size_t pfuncs_len = 5;
-#else
-const size_t pfuncs_len = 2;
-#endif /* INCLUDE_ALL_FUNCTIONS */
+const size_t pfuncs_len = (sizeof(pfuncs) / sizeof(pfuncs[0]));
+
+#define coordinate_plane_frames_len 256
 
 struct coordinate_plane_iterate_context;
 typedef struct coordinate_plane_iterate_context
@@ -178,6 +370,8 @@ struct coordinate_plane {
 	long double resolution_y;
 
 	uint64_t iteration_count;
+	/* sum over points of the steps each was iterated (escape checks) */
+	uint64_t point_steps;
 	size_t escaped;
 	size_t not_escaped;
 	uint64_t halt_after;
@@ -188,21 +382,39 @@ struct coordinate_plane {
 #else
 	void *tpool;
 #endif
+	/* a shared pool is neither resized nor freed by the plane */
+	bool tpool_shared;
 	uint32_t num_threads;
 	coordinate_plane_iterate_context_s *contexts;
 	size_t contexts_len;
 
 	size_t pfuncs_idx;
 	ldxy_s seed;
+	/* if not NULL, iterated in place of pfuncs[pfuncs_idx] */
+	function_expr_s *expr;
+
+	coordinate_plane_stats_s stats;
+	coordinate_plane_totals_s totals;
+	/* ring of the most recent frame times */
+	uint64_t frame_nsec[coordinate_plane_frames_len];
 
 	iterxy_s *all_points;
+	/* steps spent on each point, NULL unless costs are recorded */
+	uint32_t *point_costs;
+	bool record_costs;
 	size_t all_points_len;
 
+	/* dense copy of all_points[i].escaped, row-major */
+	uint32_t *escaped_counts;
+
 	iterxy_s **scratch;
 	size_t scratch_len;
 
 	iterxy_s **points_not_escaped;
 	size_t points_not_escaped_len;
+
+	/* the most bytes held at once, see coordinate_plane_memory_usage */
+	size_t memory_high_water;
 };
 
 struct coordinate_plane_iterate_context {
@@ -212,6 +424,8 @@ struct coordinate_plane_iterate_context {
 	size_t step_size;
 	size_t local_escaped;
 	size_t local_not_escaped;
+	uint64_t local_point_steps;
+	uint64_t busy_nsec;
 	iterxy_s **not_escaped;
 	size_t not_escaped_len;
 #ifndef SKIP_THREADS
@@ -221,6 +435,63 @@ struct coordinate_plane_iterate_context {
 #endif
 };
 
+uint64_t coordinate_plane_time_in_nsec(void)
+{
+	struct timespec ts = { 0, 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t nsec_per_sec = (1000 * 1000 * 1000);
+	return (nsec_per_sec * ts.tv_sec) + ts.tv_nsec;
+}
+
+void coordinate_plane_memory_usage(coordinate_plane_s *plane,
+				   coordinate_plane_memory_s *out)
+{
+	size_t points = plane->all_points ? plane->all_points_len : 0;
+	out->plane = sizeof(coordinate_plane_s);
+	out->all_points = points * sizeof(iterxy_s);
+	out->escaped_counts = plane->escaped_counts ?
+	    (points * sizeof(uint32_t)) : 0;
+	out->point_costs = plane->point_costs ? (points * sizeof(uint32_t)) : 0;
+	out->scratch = plane->scratch ?
+	    (plane->scratch_len * sizeof(iterxy_s *)) : 0;
+	out->points_not_escaped = plane->points_not_escaped ?
+	    (plane->points_not_escaped_len * sizeof(iterxy_s *)) : 0;
+	size_t context_size = sizeof(coordinate_plane_iterate_context_s);
+	out->contexts = plane->contexts ?
+	    (plane->contexts_len * context_size) : 0;
+	out->thread_pool = 0;
+#ifndef SKIP_THREADS
+	if (plane->tpool && !plane->tpool_shared) {
+		out->thread_pool = basic_thread_pool_memory_usage(plane->tpool);
+	}
+#endif
+	out->live = out->plane + out->all_points + out->escaped_counts +
+	    out->point_costs + out->scratch + out->points_not_escaped +
+	    out->contexts + out->thread_pool;
+	if (out->live > plane->memory_high_water) {
+		plane->memory_high_water = out->live;
+	}
+	out->high_water = plane->memory_high_water;
+}
+
+/* called after each allocation, so the high water is not missed */
+static void coordinate_plane_memory_track(coordinate_plane_s *plane)
+{
+	coordinate_plane_memory_s memory;
+	coordinate_plane_memory_usage(plane, &memory);
+}
+
+size_t coordinate_plane_memory_needed(uint32_t win_width, uint32_t win_height,
+				      uint32_t num_threads, bool record_costs)
+{
+	size_t points = (size_t)win_width * win_height;
+	size_t per_point = sizeof(iterxy_s) + sizeof(uint32_t) +
+	    (2 * sizeof(iterxy_s *)) + (record_costs ? sizeof(uint32_t) : 0);
+	size_t contexts = num_threads ? num_threads : 1;
+	return sizeof(coordinate_plane_s) + (points * per_point) +
+	    (contexts * sizeof(coordinate_plane_iterate_context_s));
+}
+
 long double coordinate_plane_x_min(coordinate_plane_s *plane)
 {
 	return plane->center.x - (plane->resolution_x * (plane->win_width / 2));
@@ -251,6 +522,8 @@ coordinate_plane_s *coordinate_plane_reset(coordinate_plane_s *plane,
 					   long double resolution_y,
 					   size_t pfuncs_idx, ldxy_s seed)
 {
+	uint64_t start = coordinate_plane_time_in_nsec();
+	perf_counters_begin(perf_counters_phase_reset);
 	plane->win_width = win_width;
 	plane->win_height = win_height;
 	plane->center = center;
@@ -263,6 +536,7 @@ coordinate_plane_s *coordinate_plane_reset(coordinate_plane_s *plane,
 		die("invalid resolution_y %.*Lg", DECIMAL_DIG, resolution_y);
 	}
 	plane->iteration_count = 0;
+	plane->point_steps = 0;
 	plane->escaped = 0;
 	plane->not_escaped = (plane->win_width * plane->win_height);
 	plane->pfuncs_idx = pfuncs_idx;
@@ -275,6 +549,12 @@ coordinate_plane_s *coordinate_plane_reset(coordinate_plane_s *plane,
 		plane->all_points = NULL;
 		plane->all_points_len = 0;
 
+		free(plane->escaped_counts);
+		plane->escaped_counts = NULL;
+
+		free(plane->point_costs);
+		plane->point_costs = NULL;
+
 		free(plane->scratch);
 		plane->scratch = NULL;
 		plane->scratch_len = 0;
@@ -288,6 +568,9 @@ coordinate_plane_s *coordinate_plane_reset(coordinate_plane_s *plane,
 		alloc_or_die(&plane->all_points, size);
 		plane->all_points_len = needed;
 
+		size = needed * sizeof(uint32_t);
+		alloc_or_die(&plane->escaped_counts, size);
+
 		size = needed * sizeof(iterxy_s *);
 		alloc_or_die(&plane->scratch, size);
 		plane->scratch_len = needed;
@@ -297,6 +580,16 @@ coordinate_plane_s *coordinate_plane_reset(coordinate_plane_s *plane,
 		plane->points_not_escaped_len = needed;
 	}
 
+	memset(plane->escaped_counts, 0x00, needed * sizeof(uint32_t));
+	if (plane->record_costs) {
+		if (!plane->point_costs) {
+			size_t size = plane->all_points_len * sizeof(uint32_t);
+			alloc_or_die(&plane->point_costs, size);
+		}
+		memset(plane->point_costs, 0x00, needed * sizeof(uint32_t));
+	}
+	coordinate_plane_memory_track(plane);
+
 	pfunc_init_f pfunc_init = pfuncs[plane->pfuncs_idx].pfunc_init;
 	long double x_min = coordinate_plane_x_min(plane);
 	long double y_max = coordinate_plane_y_max(plane);
@@ -324,6 +617,11 @@ coordinate_plane_s *coordinate_plane_reset(coordinate_plane_s *plane,
 			pfunc_init(p, xy, seed);
 		}
 	}
+	perf_counters_end(perf_counters_phase_reset);
+	uint64_t end = coordinate_plane_time_in_nsec();
+	++(plane->stats.reset_calls);
+	plane->stats.reset_nsec += end - start;
+	trace_event_complete("reset", start, end);
 	return plane;
 }
 
@@ -367,7 +665,7 @@ void coordinate_plane_free(coordinate_plane_s *plane)
 	if (plane) {
 		free(plane->contexts);
 #ifndef SKIP_THREADS
-		if (plane->tpool) {
+		if (plane->tpool && !plane->tpool_shared) {
 			basic_thread_pool_stop_and_free(&(plane->tpool));
 		}
 #endif
@@ -375,6 +673,12 @@ void coordinate_plane_free(coordinate_plane_s *plane)
 		plane->all_points = NULL;
 		plane->all_points_len = 0;
 
+		free(plane->escaped_counts);
+		plane->escaped_counts = NULL;
+
+		free(plane->point_costs);
+		plane->point_costs = NULL;
+
 		free(plane->scratch);
 		plane->scratch = NULL;
 		plane->scratch_len = 0;
@@ -382,6 +686,9 @@ void coordinate_plane_free(coordinate_plane_s *plane)
 		free(plane->points_not_escaped);
 		plane->points_not_escaped = NULL;
 		plane->points_not_escaped_len = 0;
+
+		function_expr_free(plane->expr);
+		plane->expr = NULL;
 	}
 	free(plane);
 }
@@ -426,6 +733,8 @@ static void coordinate_plane_update_from_iterate_context(coordinate_plane_s
 							 *ctx)
 {
 	plane->escaped += ctx->local_escaped;
+	plane->point_steps += ctx->local_point_steps;
+	plane->totals.point_steps += ctx->local_point_steps;
 	iterxy_s **start = plane->points_not_escaped + plane->not_escaped;
 	size_t size = sizeof(iterxy_s *) * ctx->local_not_escaped;
 	memcpy(start, ctx->not_escaped, size);
@@ -433,16 +742,117 @@ static void coordinate_plane_update_from_iterate_context(coordinate_plane_s
 	ctx->not_escaped_len = 0;
 }
 
-static int coordinate_plane_iterate_context(coordinate_plane_iterate_context_s
-					    *ctx)
+/* after a point's steps: count it as escaped, or keep it for next time */
+static void coordinate_plane_iterate_tally(coordinate_plane_iterate_context_s
+					   *ctx, iterxy_s *p,
+					   pfunc_root_f pfunc_root)
+{
+	coordinate_plane_s *plane = ctx->plane;
+	size_t idx = p - plane->all_points;
+	uint64_t spent;
+	if (p->escaped) {
+		if (pfunc_root) {
+			p->root = pfunc_root(p->z);
+		}
+		plane->escaped_counts[idx] = p->escaped;
+		++(ctx->local_escaped);
+		spent = p->escaped - plane->iteration_count;
+	} else {
+		ctx->not_escaped[ctx->local_not_escaped] = p;
+		++(ctx->local_not_escaped);
+		spent = ctx->steps;
+	}
+	ctx->local_point_steps += spent;
+	if (plane->point_costs) {
+		plane->point_costs[idx] += spent;
+	}
+}
+
+/*
+ A formula runs function_expr_lanes points at a time: their z, c and
+ seed are loaded into the registers of the machine, every lane takes
+ each step, and a lane's z is saved as it escapes; later steps of that
+ lane are wasted work, but keep the loops over the lanes branch free.
+*/
+static void coordinate_plane_expr_block(coordinate_plane_iterate_context_s
+					*ctx, iterxy_s **points, size_t len,
+					function_expr_vm_s *vm)
+{
+	coordinate_plane_s *plane = ctx->plane;
+	double *z_re = vm->re[function_expr_reg_z];
+	double *z_im = vm->im[function_expr_reg_z];
+	vm->len = len;
+	for (size_t l = 0; l < len; ++l) {
+		iterxy_s *p = points[l];
+		z_re[l] = p->z.x;
+		z_im[l] = p->z.y;
+		vm->re[function_expr_reg_c][l] = p->c.x;
+		vm->im[function_expr_reg_c][l] = p->c.y;
+		vm->re[function_expr_reg_seed][l] = p->seed.x;
+		vm->im[function_expr_reg_seed][l] = p->seed.y;
+	}
+	function_expr_load(plane->expr, vm);
+
+	size_t active = len;
+	for (size_t i = 0; i < ctx->steps && active; ++i) {
+		for (size_t l = 0; l < len; ++l) {
+			iterxy_s *p = points[l];
+			if (p->escaped) {
+				continue;
+			}
+			double r2 = (z_re[l] * z_re[l]) + (z_im[l] * z_im[l]);
+			/* a NaN, as from 1/z at zero, never comes back */
+			if (!(r2 <= (2.0 * 2.0))) {
+				p->escaped = plane->iteration_count + i + 1;
+				p->z.x = z_re[l];
+				p->z.y = z_im[l];
+				--active;
+			}
+		}
+		if (active) {
+			function_expr_step(plane->expr, vm);
+		}
+	}
+
+	for (size_t l = 0; l < len; ++l) {
+		iterxy_s *p = points[l];
+		if (!p->escaped) {
+			p->z.x = z_re[l];
+			p->z.y = z_im[l];
+		}
+		coordinate_plane_iterate_tally(ctx, p, NULL);
+	}
+}
+
+static void coordinate_plane_iterate_expr(coordinate_plane_iterate_context_s
+					  *ctx)
+{
+	coordinate_plane_s *plane = ctx->plane;
+	function_expr_vm_s vm;
+	iterxy_s *points[function_expr_lanes];
+	size_t len = 0;
+	for (size_t j = ctx->offset; j < plane->not_escaped;
+	     j += ctx->step_size) {
+		points[len++] = plane->points_not_escaped[j];
+		if (len == function_expr_lanes) {
+			coordinate_plane_expr_block(ctx, points, len, &vm);
+			len = 0;
+		}
+	}
+	if (len) {
+		coordinate_plane_expr_block(ctx, points, len, &vm);
+	}
+}
+
+static void coordinate_plane_iterate_pfunc(coordinate_plane_iterate_context_s
+					   *ctx)
 {
 	coordinate_plane_s *plane = ctx->plane;
 
 	pfunc_f pfunc = pfuncs[plane->pfuncs_idx].pfunc;
 	pfunc_escape_f pfunc_escape = pfuncs[plane->pfuncs_idx].pfunc_escape;
+	pfunc_root_f pfunc_root = pfuncs[plane->pfuncs_idx].pfunc_root;
 
-	ctx->local_escaped = 0;
-	ctx->local_not_escaped = 0;
 	for (size_t j = ctx->offset; j < plane->not_escaped;
 	     j += ctx->step_size) {
 		iterxy_s *p = plane->points_not_escaped[j];
@@ -455,13 +865,29 @@ static int coordinate_plane_iterate_context(coordinate_plane_iterate_context_s
 			}
 		}
 
-		if (p->escaped) {
-			++(ctx->local_escaped);
-		} else {
-			ctx->not_escaped[ctx->local_not_escaped] = p;
-			++(ctx->local_not_escaped);
-		}
+		coordinate_plane_iterate_tally(ctx, p, pfunc_root);
+	}
+}
+
+static int coordinate_plane_iterate_context(coordinate_plane_iterate_context_s
+					    *ctx)
+{
+	coordinate_plane_s *plane = ctx->plane;
+
+	uint64_t start = coordinate_plane_time_in_nsec();
+	perf_counters_begin(perf_counters_phase_iterate);
+	ctx->local_escaped = 0;
+	ctx->local_not_escaped = 0;
+	ctx->local_point_steps = 0;
+	if (plane->expr) {
+		coordinate_plane_iterate_expr(ctx);
+	} else {
+		coordinate_plane_iterate_pfunc(ctx);
 	}
+	perf_counters_end(perf_counters_phase_iterate);
+	uint64_t end = coordinate_plane_time_in_nsec();
+	ctx->busy_nsec = end - start;
+	trace_event_complete("iterate_context", start, end);
 
 	ctx->done = true;
 
@@ -475,10 +901,21 @@ static void coordinate_plane_iterate_single_threaded(coordinate_plane_s *plane,
 	coordinate_plane_iterate_context_init(plane, steps, offset, 1);
 
 	coordinate_plane_iterate_context_s *context = plane->contexts + offset;
+	uint64_t start = coordinate_plane_time_in_nsec();
 	coordinate_plane_iterate_context(context);
+	uint64_t joined = coordinate_plane_time_in_nsec();
 
+	perf_counters_begin(perf_counters_phase_merge);
 	plane->not_escaped = 0;
 	coordinate_plane_update_from_iterate_context(plane, context);
+	perf_counters_end(perf_counters_phase_merge);
+	uint64_t merged = coordinate_plane_time_in_nsec();
+
+	plane->stats.parallel_nsec += joined - start;
+	plane->stats.worker_slots_nsec += joined - start;
+	plane->stats.worker_busy_nsec += context->busy_nsec;
+	plane->stats.merge_nsec += merged - joined;
+	trace_event_complete("merge", joined, merged);
 }
 
 #ifndef SKIP_THREADS
@@ -500,14 +937,18 @@ static void coordinate_plane_iterate_multi_threaded(coordinate_plane_s *plane,
 		return;
 	}
 	basic_thread_pool_s *pool = plane->tpool;
-	if (pool == NULL || basic_thread_pool_size(pool) < num_threads) {
+	if (!plane->tpool_shared && (pool == NULL
+				     || basic_thread_pool_size(pool) <
+				     num_threads)) {
 		if (pool) {
 			basic_thread_pool_stop_and_free(&(plane->tpool));
 		}
 		plane->tpool = basic_thread_pool_new(plane->num_threads);
 		assert(plane->tpool);
+		coordinate_plane_memory_track(plane);
 	}
 
+	uint64_t start = coordinate_plane_time_in_nsec();
 	for (size_t i = 0; i < num_threads; ++i) {
 		coordinate_plane_iterate_context_init(plane, steps, i,
 						      num_threads);
@@ -516,20 +957,53 @@ static void coordinate_plane_iterate_multi_threaded(coordinate_plane_s *plane,
 		basic_thread_pool_add(plane->tpool, func, arg);
 	}
 	thrd_yield();
-	basic_thread_pool_wait(plane->tpool);
+	if (!plane->tpool_shared) {
+		basic_thread_pool_wait(plane->tpool);
+	}
 
-	plane->not_escaped = 0;
+	/* workers read plane->not_escaped, merge only once all are done */
 	for (size_t i = 0; i < num_threads; ++i) {
 		while (!plane->contexts[i].done) {
-			thrd_yield();
+			/* a shared pool may hold other planes' tasks */
+			if (!plane->tpool_shared
+			    || !basic_thread_pool_help(plane->tpool)) {
+				thrd_yield();
+			}
 		}
+	}
+	uint64_t joined = coordinate_plane_time_in_nsec();
+
+	perf_counters_begin(perf_counters_phase_merge);
+	plane->not_escaped = 0;
+	for (size_t i = 0; i < num_threads; ++i) {
 		coordinate_plane_iterate_context_s *ctx = plane->contexts + i;
 		coordinate_plane_update_from_iterate_context(plane, ctx);
+		plane->stats.worker_busy_nsec += ctx->busy_nsec;
 	}
+	perf_counters_end(perf_counters_phase_merge);
+	uint64_t merged = coordinate_plane_time_in_nsec();
+
+	plane->stats.parallel_nsec += joined - start;
+	plane->stats.worker_slots_nsec += (joined - start) * num_threads;
+	plane->stats.merge_nsec += merged - joined;
+	trace_event_complete("parallel", start, joined);
+	trace_event_complete("merge", joined, merged);
 }
 
 #endif /* #ifndef SKIP_THREADS */
 
+#ifndef SKIP_THREADS
+void coordinate_plane_share_thread_pool(coordinate_plane_s *plane,
+					basic_thread_pool_s *pool)
+{
+	if (plane->tpool && !plane->tpool_shared) {
+		basic_thread_pool_stop_and_free(&(plane->tpool));
+	}
+	plane->tpool = pool;
+	plane->tpool_shared = true;
+}
+#endif /* #ifndef SKIP_THREADS */
+
 size_t coordinate_plane_iterate(coordinate_plane_s *plane, uint32_t steps)
 {
 	size_t old_escaped = plane->escaped;
@@ -547,6 +1021,7 @@ size_t coordinate_plane_iterate(coordinate_plane_s *plane, uint32_t steps)
 	}
 
 	if (steps) {
+		uint64_t start = coordinate_plane_time_in_nsec();
 #ifndef SKIP_THREADS
 		coordinate_plane_iterate_multi_threaded(plane, steps);
 #else
@@ -554,6 +1029,11 @@ size_t coordinate_plane_iterate(coordinate_plane_s *plane, uint32_t steps)
 #endif /* #ifndef SKIP_THREADS */
 
 		plane->iteration_count += steps;
+		plane->totals.iterations += steps;
+		uint64_t end = coordinate_plane_time_in_nsec();
+		++(plane->stats.iterate_calls);
+		plane->stats.iterate_nsec += end - start;
+		trace_event_complete("iterate", start, end);
 	}
 
 	assert(plane->escaped >= old_escaped);
@@ -563,6 +1043,10 @@ size_t coordinate_plane_iterate(coordinate_plane_s *plane, uint32_t steps)
 
 void coordinate_plane_next_function(coordinate_plane_s *plane)
 {
+	/* from a formula, back to the table where it left off */
+	function_expr_free(plane->expr);
+	plane->expr = NULL;
+
 	size_t old_pfuncs_idx = plane->pfuncs_idx;
 	size_t new_pfuncs_idx = 1 + old_pfuncs_idx;
 	if (new_pfuncs_idx >= pfuncs_len) {
@@ -715,6 +1199,7 @@ void coordinate_plane_threads_more(coordinate_plane_s *plane)
 		coordinate_plane_iterate_context_s *contexts;
 		alloc_or_die(&contexts, size);
 		plane->contexts = contexts;
+		coordinate_plane_memory_track(plane);
 	}
 }
 
@@ -732,6 +1217,9 @@ const char *coordinate_plane_program(coordinate_plane_s *plane)
 
 const char *coordinate_plane_function_name(coordinate_plane_s *plane)
 {
+	if (plane->expr) {
+		return function_expr_source(plane->expr);
+	}
 	return pfuncs[plane->pfuncs_idx].name;
 }
 
@@ -740,6 +1228,39 @@ size_t coordinate_plane_function_index(coordinate_plane_s *plane)
 	return plane->pfuncs_idx;
 }
 
+bool coordinate_plane_function_converges(coordinate_plane_s *plane)
+{
+	if (plane->expr) {
+		return false;
+	}
+	return pfuncs[plane->pfuncs_idx].pfunc_root ? true : false;
+}
+
+int coordinate_plane_function_expr(coordinate_plane_s *plane,
+				   const char *source, char *err,
+				   size_t err_len)
+{
+	function_expr_s *expr = NULL;
+	if (source) {
+		expr = function_expr_compile(source, err, err_len);
+		if (!expr) {
+			return 1;
+		}
+	}
+	function_expr_free(plane->expr);
+	plane->expr = expr;
+	coordinate_plane_reset(plane, plane->win_width, plane->win_height,
+			       plane->center, plane->resolution_x,
+			       plane->resolution_y, plane->pfuncs_idx,
+			       plane->seed);
+	return 0;
+}
+
+const char *coordinate_plane_function_expr_source(coordinate_plane_s *plane)
+{
+	return plane->expr ? function_expr_source(plane->expr) : NULL;
+}
+
 void coordinate_plane_center(coordinate_plane_s *plane, ldxy_s *out)
 {
 	out->x = plane->center.x;
@@ -776,8 +1297,101 @@ uint64_t coordinate_plane_escaped(coordinate_plane_s *plane, uint32_t x,
 				  uint32_t y)
 {
 	size_t i = (y * plane->win_width) + x;
-	iterxy_s *p = plane->all_points + i;
-	return p->escaped;
+	return plane->escaped_counts[i];
+}
+
+uint32_t coordinate_plane_root(coordinate_plane_s *plane, uint32_t x,
+			       uint32_t y)
+{
+	size_t i = (y * plane->win_width) + x;
+	return plane->all_points[i].root;
+}
+
+const uint32_t *coordinate_plane_escaped_view(coordinate_plane_s *plane)
+{
+	return plane->escaped_counts;
+}
+
+static size_t coordinate_plane_copy_region(coordinate_plane_s *plane,
+					   const uint32_t *from_counts,
+					   const coordinate_plane_rect_s *rect,
+					   uint32_t *out, size_t out_stride)
+{
+	coordinate_plane_rect_s all = { 0, 0, plane->win_width,
+		plane->win_height
+	};
+	if (!rect) {
+		rect = &all;
+	}
+	if (rect->x >= plane->win_width || rect->y >= plane->win_height) {
+		return 0;
+	}
+
+	size_t width = rect->width;
+	if (width > (plane->win_width - rect->x)) {
+		width = plane->win_width - rect->x;
+	}
+	size_t height = rect->height;
+	if (height > (plane->win_height - rect->y)) {
+		height = plane->win_height - rect->y;
+	}
+	if (!out_stride) {
+		out_stride = width;
+	}
+
+	size_t row_size = sizeof(uint32_t) * width;
+	for (size_t y = 0; y < height; ++y) {
+		size_t from = ((rect->y + y) * plane->win_width) + rect->x;
+		memcpy(out + (y * out_stride), from_counts + from, row_size);
+	}
+	return width * height;
+}
+
+size_t coordinate_plane_escaped_region(coordinate_plane_s *plane,
+				       const coordinate_plane_rect_s *rect,
+				       uint32_t *out, size_t out_stride)
+{
+	return coordinate_plane_copy_region(plane, plane->escaped_counts, rect,
+					    out, out_stride);
+}
+
+void coordinate_plane_record_costs(coordinate_plane_s *plane, bool record)
+{
+	if (plane->record_costs == record) {
+		return;
+	}
+	plane->record_costs = record;
+	if (!record) {
+		free(plane->point_costs);
+		plane->point_costs = NULL;
+		return;
+	}
+	/* start over, so that every step taken is counted */
+	coordinate_plane_reset(plane, plane->win_width, plane->win_height,
+			       plane->center, plane->resolution_x,
+			       plane->resolution_y, plane->pfuncs_idx,
+			       plane->seed);
+}
+
+bool coordinate_plane_recording_costs(coordinate_plane_s *plane)
+{
+	return plane->record_costs;
+}
+
+const uint32_t *coordinate_plane_costs_view(coordinate_plane_s *plane)
+{
+	return plane->point_costs;
+}
+
+size_t coordinate_plane_costs_region(coordinate_plane_s *plane,
+				     const coordinate_plane_rect_s *rect,
+				     uint32_t *out, size_t out_stride)
+{
+	if (!plane->point_costs) {
+		return 0;
+	}
+	return coordinate_plane_copy_region(plane, plane->point_costs, rect,
+					    out, out_stride);
 }
 
 uint64_t coordinate_plane_iteration_count(coordinate_plane_s *plane)
@@ -785,6 +1399,11 @@ uint64_t coordinate_plane_iteration_count(coordinate_plane_s *plane)
 	return plane->iteration_count;
 }
 
+uint64_t coordinate_plane_point_steps(coordinate_plane_s *plane)
+{
+	return plane->point_steps;
+}
+
 size_t coordinate_plane_escaped_count(coordinate_plane_s *plane)
 {
 	return plane->escaped;
@@ -795,6 +1414,69 @@ size_t coordinate_plane_not_escaped_count(coordinate_plane_s *plane)
 	return plane->not_escaped;
 }
 
+static int coordinate_plane_compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+void coordinate_plane_stats(coordinate_plane_s *plane,
+			    coordinate_plane_stats_s *out)
+{
+	*out = plane->stats;
+
+	size_t len = plane->stats.frames;
+	if (len > coordinate_plane_frames_len) {
+		len = coordinate_plane_frames_len;
+	}
+	if (!len) {
+		return;
+	}
+	uint64_t sorted[coordinate_plane_frames_len];
+	memcpy(sorted, plane->frame_nsec, sizeof(uint64_t) * len);
+	qsort(sorted, len, sizeof(uint64_t), coordinate_plane_compare_u64);
+	out->frame_p50_nsec = sorted[len / 2];
+	out->frame_p99_nsec = sorted[(len * 99) / 100];
+}
+
+void coordinate_plane_stats_clear(coordinate_plane_s *plane)
+{
+	memset(&plane->stats, 0x00, sizeof(coordinate_plane_stats_s));
+}
+
+void coordinate_plane_totals(coordinate_plane_s *plane,
+			     coordinate_plane_totals_s *out)
+{
+	*out = plane->totals;
+}
+
+void coordinate_plane_stats_add_phase(coordinate_plane_s *plane,
+				      enum coordinate_plane_phase phase,
+				      uint64_t nsec)
+{
+	switch (phase) {
+	case coordinate_plane_phase_colourize:
+		plane->stats.colourize_nsec += nsec;
+		break;
+	case coordinate_plane_phase_upload:
+		plane->stats.upload_nsec += nsec;
+		break;
+	case coordinate_plane_phase_present:
+		plane->stats.present_nsec += nsec;
+		break;
+	}
+}
+
+void coordinate_plane_stats_add_frame(coordinate_plane_s *plane,
+				      uint64_t nsec)
+{
+	size_t i = plane->stats.frames % coordinate_plane_frames_len;
+	plane->frame_nsec[i] = nsec;
+	++(plane->stats.frames);
+	++(plane->totals.frames);
+}
+
 size_t coordinate_plane_num_threads(coordinate_plane_s *plane)
 {
 	return plane->num_threads;
@@ -31,27 +31,112 @@ typedef struct iterxy {
 	ldxy_s z;
 
 	uint32_t escaped;
+
+	/* for functions which stop on convergence: one plus the index of
+	   the root reached, zero if none (yet) */
+	uint32_t root;
 } iterxy_s;
 
 typedef void (*pfunc_init_f)(iterxy_s *p, ldxy_s xy, ldxy_s seed);
 typedef void (*pfunc_f)(iterxy_s *p);
 typedef bool (*pfunc_escape_f)(ldxy_s xy);
+typedef uint32_t (*pfunc_root_f)(ldxy_s xy);
 
+/*
+ The pfunc_escape is the termination predicate: once it is true the
+ point leaves the live set. For escape-time functions that is escape
+ to infinity and pfunc_root is NULL. For functions which instead stop
+ on convergence, such as Newton's method, pfunc_escape is true near a
+ root and pfunc_root is called once, as the point stops, to say which.
+*/
 typedef struct named_pfunc {
 	pfunc_init_f pfunc_init;
 	pfunc_escape_f pfunc_escape;
 	pfunc_f pfunc;
+	pfunc_root_f pfunc_root;
 	const char *name;
 } named_pfunc_s;
 
 #define pfuncs_mandlebrot_idx	0U
 #define pfuncs_julia_idx	(pfuncs_mandlebrot_idx + 1U)
-extern named_pfunc_s pfuncs[];
+extern const named_pfunc_s pfuncs[];
 extern const size_t pfuncs_len;
 
 struct coordinate_plane;
 typedef struct coordinate_plane coordinate_plane_s;
 
+/* phases which happen outside of the plane, timed by the frontend */
+enum coordinate_plane_phase {
+	coordinate_plane_phase_colourize,
+	coordinate_plane_phase_upload,
+	coordinate_plane_phase_present
+};
+
+/*
+ Accumulated over the life of the plane, or since stats_clear.
+ reset: setting up the points, including each resize
+ iterate: the whole of each coordinate_plane_iterate call, of which
+ parallel: from queueing the first task until every task is done
+ merge: the serial gathering of each task's results afterward
+ worker_busy: summed over tasks, the time each spent iterating
+ worker_slots: parallel time multiplied by the number of tasks, so that
+	1 - (worker_busy / worker_slots) is the fraction of the workers'
+	time lost to pool overhead and imbalance
+ colourize, upload, present: as added by the frontend
+ frame_p50, frame_p99: over the most recent frames added
+*/
+typedef struct coordinate_plane_stats {
+	uint64_t reset_calls;
+	uint64_t reset_nsec;
+	uint64_t iterate_calls;
+	uint64_t iterate_nsec;
+	uint64_t parallel_nsec;
+	uint64_t merge_nsec;
+	uint64_t worker_busy_nsec;
+	uint64_t worker_slots_nsec;
+	uint64_t colourize_nsec;
+	uint64_t upload_nsec;
+	uint64_t present_nsec;
+	uint64_t frames;
+	uint64_t frame_p50_nsec;
+	uint64_t frame_p99_nsec;
+} coordinate_plane_stats_s;
+
+/*
+ Counted over the whole life of the plane: neither a reset nor
+ stats_clear sets these back, so they only ever go up.
+*/
+typedef struct coordinate_plane_totals {
+	uint64_t iterations;
+	uint64_t point_steps;
+	uint64_t frames;
+} coordinate_plane_totals_s;
+
+/*
+ Bytes held by the plane now (live) and the most it has held at once
+ (high_water). thread_pool is the pool's bookkeeping and queued tasks,
+ not the stacks of its threads, and is zero for a shared pool.
+*/
+typedef struct coordinate_plane_memory {
+	size_t plane;
+	size_t all_points;
+	size_t escaped_counts;
+	size_t point_costs;
+	size_t scratch;
+	size_t points_not_escaped;
+	size_t contexts;
+	size_t thread_pool;
+	size_t live;
+	size_t high_water;
+} coordinate_plane_memory_s;
+
+typedef struct coordinate_plane_rect {
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+} coordinate_plane_rect_s;
+
 coordinate_plane_s *coordinate_plane_reset(coordinate_plane_s *plane,
 					   uint32_t win_width,
 					   uint32_t win_height,
@@ -77,6 +162,16 @@ void coordinate_plane_free(coordinate_plane_s *plane);
 void coordinate_plane_resize(coordinate_plane_s *plane, uint32_t new_win_width,
 			     uint32_t new_win_height, bool preserve_ratio);
 
+#ifndef SKIP_THREADS
+struct basic_thread_pool;
+
+/* iterate with a pool owned by the caller and possibly shared by other
+   planes; the plane will neither resize nor free it. Use with num_threads
+   no larger than the pool's size */
+void coordinate_plane_share_thread_pool(coordinate_plane_s *plane,
+					struct basic_thread_pool *pool);
+#endif
+
 size_t coordinate_plane_iterate(coordinate_plane_s *plane, uint32_t steps);
 
 void coordinate_plane_next_function(coordinate_plane_s *plane);
@@ -102,7 +197,43 @@ void coordinate_plane_threads_less(coordinate_plane_s *plane);
 
 uint64_t coordinate_plane_escaped(coordinate_plane_s *plane, uint32_t x,
 				  uint32_t y);
+
+/* one plus the index of the root the point converged to, zero if it
+   did not (yet), or if the function does not stop on convergence */
+uint32_t coordinate_plane_root(coordinate_plane_s *plane, uint32_t x,
+			       uint32_t y);
+
+/* read-only, row-major, win_width counts per row; zero means not (yet)
+   escaped. Valid until the next reset, resize, or free of the plane */
+const uint32_t *coordinate_plane_escaped_view(coordinate_plane_s *plane);
+
+/* copies the escape counts of rect (NULL for the whole plane), clipped
+   to the plane, into out with rows out_stride counts apart (0 for
+   tightly packed); returns the number of counts copied */
+size_t coordinate_plane_escaped_region(coordinate_plane_s *plane,
+				       const coordinate_plane_rect_s *rect,
+				       uint32_t *out, size_t out_stride);
+
+/*
+ Optionally the plane also records the steps spent on each point,
+ including the steps on points which have not (yet) escaped: where the
+ compute goes. Turning recording on restarts the iteration of the plane
+ so that every step is counted; it stays on through resets.
+*/
+void coordinate_plane_record_costs(coordinate_plane_s *plane, bool record);
+bool coordinate_plane_recording_costs(coordinate_plane_s *plane);
+
+/* as the escaped_view, or NULL if costs are not being recorded */
+const uint32_t *coordinate_plane_costs_view(coordinate_plane_s *plane);
+
+/* as the escaped_region; returns 0 if costs are not being recorded */
+size_t coordinate_plane_costs_region(coordinate_plane_s *plane,
+				     const coordinate_plane_rect_s *rect,
+				     uint32_t *out, size_t out_stride);
+
 uint64_t coordinate_plane_iteration_count(coordinate_plane_s *plane);
+/* total steps taken by individual points since the last reset */
+uint64_t coordinate_plane_point_steps(coordinate_plane_s *plane);
 
 uint32_t coordinate_plane_win_width(coordinate_plane_s *plane);
 uint32_t coordinate_plane_win_height(coordinate_plane_s *plane);
@@ -113,6 +244,24 @@ long double coordinate_plane_y_max(coordinate_plane_s *plane);
 const char *coordinate_plane_program(coordinate_plane_s *plane);
 const char *coordinate_plane_function_name(coordinate_plane_s *plane);
 size_t coordinate_plane_function_index(coordinate_plane_s *plane);
+/* true if the function stops on convergence to a root */
+bool coordinate_plane_function_converges(coordinate_plane_s *plane);
+
+/*
+ Iterates a formula such as "z^3 + c*z + seed" in place of the pfuncs[]
+ function, see function-expr.h; each z starts as the init of the
+ pfuncs[] function would start it, so zero for the mandlebrot and the
+ location of its point for the julia, and escapes beyond radius 2, or
+ once it is no longer a finite number. Restarts the iteration of the
+ plane. A NULL source, or coordinate_plane_next_function, returns to
+ the pfuncs[] function. Returns 0 on success, or non-zero with a
+ message in err and the plane unchanged.
+*/
+int coordinate_plane_function_expr(coordinate_plane_s *plane,
+				   const char *source, char *err,
+				   size_t err_len);
+/* the formula, or NULL if iterating a pfuncs[] function */
+const char *coordinate_plane_function_expr_source(coordinate_plane_s *plane);
 void coordinate_plane_center(coordinate_plane_s *plane, ldxy_s *out);
 void coordinate_plane_seed(coordinate_plane_s *plane, ldxy_s *out);
 long double coordinate_plane_resolution_x(coordinate_plane_s *plane);
@@ -122,5 +271,23 @@ uint32_t coordinate_plane_skip_rounds(coordinate_plane_s *plane);
 size_t coordinate_plane_escaped_count(coordinate_plane_s *plane);
 size_t coordinate_plane_not_escaped_count(coordinate_plane_s *plane);
 size_t coordinate_plane_num_threads(coordinate_plane_s *plane);
+void coordinate_plane_stats(coordinate_plane_s *plane,
+			    coordinate_plane_stats_s *out);
+void coordinate_plane_stats_clear(coordinate_plane_s *plane);
+void coordinate_plane_totals(coordinate_plane_s *plane,
+			     coordinate_plane_totals_s *out);
+void coordinate_plane_stats_add_phase(coordinate_plane_s *plane,
+				      enum coordinate_plane_phase phase,
+				      uint64_t nsec);
+/* the time from one frame to the next, for the percentiles */
+void coordinate_plane_stats_add_frame(coordinate_plane_s *plane,
+				      uint64_t nsec);
+void coordinate_plane_memory_usage(coordinate_plane_s *plane,
+				   coordinate_plane_memory_s *out);
+/* the live bytes of a new plane of this size, before creating it */
+size_t coordinate_plane_memory_needed(uint32_t win_width, uint32_t win_height,
+				      uint32_t num_threads, bool record_costs);
+/* CLOCK_MONOTONIC, the clock of the stats */
+uint64_t coordinate_plane_time_in_nsec(void);
 
 #endif /* COORD_PLANE_ITERATION_H */
@@ -0,0 +1,247 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* coord-plane-metrics.c: Prometheus text and CSV timeline of a plane */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include <logerr-die.h>
+#include <coord-plane-metrics.h>
+
+typedef struct coordinate_plane_metrics_sample {
+	double uptime_sec;
+	double iterations_per_sec;
+	double points_per_sec;
+	uint64_t iterations;
+	uint64_t iterations_total;
+	uint64_t point_steps_total;
+	size_t escaped;
+	size_t not_escaped;
+	double frame_p50_sec;
+	double frame_p99_sec;
+	uint64_t frames_total;
+	size_t threads;
+	size_t memory_live;
+	size_t memory_high_water;
+} coordinate_plane_metrics_sample_s;
+
+static double nsec_to_sec(uint64_t nsec)
+{
+	return nsec / (1000.0 * 1000.0 * 1000.0);
+}
+
+int coordinate_plane_metrics_init(coordinate_plane_metrics_s *metrics,
+				  const char *path, const char *csv_path,
+				  uint32_t interval_sec)
+{
+	uint64_t nsec_per_sec = (1000 * 1000 * 1000);
+	metrics->path = path;
+	metrics->csv = NULL;
+	metrics->interval_nsec = (interval_sec ? interval_sec : 1) *
+	    nsec_per_sec;
+	metrics->start_nsec = coordinate_plane_time_in_nsec();
+	metrics->last_nsec = metrics->start_nsec;
+	memset(&metrics->last, 0x00, sizeof(coordinate_plane_totals_s));
+
+	if (path) {
+		/* fail now, rather than at the first interval */
+		char tmp_path[4096];
+		snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+		FILE *out = fopen(tmp_path, "w");
+		if (!out) {
+			logerror("could not open '%s' (%s)", tmp_path,
+				 strerror(errno));
+			return 1;
+		}
+		fclose(out);
+		remove(tmp_path);
+	}
+
+	if (!csv_path) {
+		return 0;
+	}
+	metrics->csv = fopen(csv_path, "w");
+	if (!metrics->csv) {
+		logerror("could not open '%s' (%s)", csv_path, strerror(errno));
+		return 1;
+	}
+	fprintf(metrics->csv, "uptime_sec,iterations,iterations_per_sec,"
+		"points_per_sec,escaped,not_escaped,frames,frame_p50_ms,"
+		"frame_p99_ms,threads,memory_bytes,memory_high_water_bytes\n");
+	fflush(metrics->csv);
+	return 0;
+}
+
+static void metrics_sample(coordinate_plane_metrics_s *metrics,
+			   coordinate_plane_s *plane, pixel_buffer_s *buf,
+			   coordinate_plane_metrics_sample_s *out)
+{
+	uint64_t now = coordinate_plane_time_in_nsec();
+	double elapsed = nsec_to_sec(now - metrics->last_nsec);
+	coordinate_plane_totals_s totals;
+	coordinate_plane_totals(plane, &totals);
+	uint64_t iterations_delta =
+	    totals.iterations - metrics->last.iterations;
+	uint64_t point_steps_delta =
+	    totals.point_steps - metrics->last.point_steps;
+	metrics->last = totals;
+	metrics->last_nsec = now;
+
+	coordinate_plane_stats_s stats;
+	coordinate_plane_stats(plane, &stats);
+	coordinate_plane_memory_s memory;
+	coordinate_plane_memory_usage(plane, &memory);
+
+	out->uptime_sec = nsec_to_sec(now - metrics->start_nsec);
+	out->iterations_per_sec = (elapsed > 0.0) ?
+	    (iterations_delta / elapsed) : 0.0;
+	out->points_per_sec = (elapsed > 0.0) ?
+	    (point_steps_delta / elapsed) : 0.0;
+	out->iterations = coordinate_plane_iteration_count(plane);
+	out->iterations_total = totals.iterations;
+	out->point_steps_total = totals.point_steps;
+	out->frames_total = totals.frames;
+	out->escaped = coordinate_plane_escaped_count(plane);
+	out->not_escaped = coordinate_plane_not_escaped_count(plane);
+	out->frame_p50_sec = nsec_to_sec(stats.frame_p50_nsec);
+	out->frame_p99_sec = nsec_to_sec(stats.frame_p99_nsec);
+	out->threads = coordinate_plane_num_threads(plane);
+	out->memory_live = memory.live;
+	out->memory_high_water = memory.high_water;
+	if (buf) {
+		pixel_buffer_memory_s pixel_memory;
+		pixel_buffer_memory_usage(buf, &pixel_memory);
+		out->memory_live += pixel_memory.live;
+		out->memory_high_water += pixel_memory.high_water;
+	}
+}
+
+static void metrics_print_one(FILE *out, const char *name, const char *type,
+			      const char *help, double value)
+{
+	fprintf(out, "# HELP %s %s\n", name, help);
+	fprintf(out, "# TYPE %s %s\n", name, type);
+	fprintf(out, "%s %.15g\n", name, value);
+}
+
+static void metrics_print_prometheus(FILE *out, coordinate_plane_s *plane,
+				     coordinate_plane_metrics_sample_s *s)
+{
+	const char *function = coordinate_plane_function_name(plane);
+	metrics_print_one(out, "coord_plane_uptime_seconds", "gauge",
+			  "Seconds since the metrics started", s->uptime_sec);
+	metrics_print_one(out, "coord_plane_iterations_total", "counter",
+			  "Iterations of the plane, across resets",
+			  s->iterations_total);
+	metrics_print_one(out, "coord_plane_point_steps_total", "counter",
+			  "Steps of individual points, across resets",
+			  s->point_steps_total);
+	metrics_print_one(out, "coord_plane_iterations", "gauge",
+			  "Iterations since the last reset", s->iterations);
+	metrics_print_one(out, "coord_plane_iterations_per_second", "gauge",
+			  "Iterations per second, over the last interval",
+			  s->iterations_per_sec);
+	metrics_print_one(out, "coord_plane_points_per_second", "gauge",
+			  "Point steps per second, over the last interval",
+			  s->points_per_sec);
+	metrics_print_one(out, "coord_plane_escaped_points", "gauge",
+			  "Points which have escaped", s->escaped);
+	metrics_print_one(out, "coord_plane_not_escaped_points", "gauge",
+			  "Points which have not (yet) escaped",
+			  s->not_escaped);
+	metrics_print_one(out, "coord_plane_threads", "gauge",
+			  "Threads iterating the plane", s->threads);
+
+	const char *name = "coord_plane_frame_seconds";
+	fprintf(out, "# HELP %s Time from one frame to the next\n", name);
+	fprintf(out, "# TYPE %s summary\n", name);
+	fprintf(out, "%s{quantile=\"0.5\"} %.9f\n", name, s->frame_p50_sec);
+	fprintf(out, "%s{quantile=\"0.99\"} %.9f\n", name, s->frame_p99_sec);
+	fprintf(out, "%s_count %" PRIu64 "\n", name, s->frames_total);
+
+	name = "coord_plane_memory_bytes";
+	fprintf(out, "# HELP %s Bytes held by the plane and pixels\n", name);
+	fprintf(out, "# TYPE %s gauge\n", name);
+	fprintf(out, "%s{kind=\"live\"} %zu\n", name, s->memory_live);
+	fprintf(out, "%s{kind=\"high_water\"} %zu\n", name,
+		s->memory_high_water);
+
+	name = "coord_plane_info";
+	fprintf(out, "# HELP %s The function being iterated\n", name);
+	fprintf(out, "# TYPE %s gauge\n", name);
+	fprintf(out, "%s{function=\"%s\"} 1\n", name, function);
+}
+
+static void metrics_write_prometheus(coordinate_plane_metrics_s *metrics,
+				     coordinate_plane_s *plane,
+				     coordinate_plane_metrics_sample_s *s)
+{
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", metrics->path);
+	FILE *out = fopen(tmp_path, "w");
+	if (!out) {
+		logerror("could not open '%s' (%s)", tmp_path, strerror(errno));
+		return;
+	}
+	metrics_print_prometheus(out, plane, s);
+	if (fclose(out)) {
+		logerror("could not write '%s' (%s)", tmp_path,
+			 strerror(errno));
+		return;
+	}
+	if (rename(tmp_path, metrics->path)) {
+		logerror("could not rename '%s' to '%s' (%s)", tmp_path,
+			 metrics->path, strerror(errno));
+	}
+}
+
+static void metrics_write_csv(FILE *csv, coordinate_plane_metrics_sample_s *s)
+{
+	fprintf(csv, "%.3f,%" PRIu64 ",%.0f,%.0f,%zu,%zu,%" PRIu64
+		",%.3f,%.3f,%zu,%zu,%zu\n", s->uptime_sec, s->iterations,
+		s->iterations_per_sec, s->points_per_sec, s->escaped,
+		s->not_escaped, s->frames_total, 1000.0 * s->frame_p50_sec,
+		1000.0 * s->frame_p99_sec, s->threads, s->memory_live,
+		s->memory_high_water);
+	fflush(csv);
+}
+
+void coordinate_plane_metrics_write(coordinate_plane_metrics_s *metrics,
+				    coordinate_plane_s *plane,
+				    pixel_buffer_s *buf)
+{
+	if (!metrics->path && !metrics->csv) {
+		return;
+	}
+	coordinate_plane_metrics_sample_s sample;
+	metrics_sample(metrics, plane, buf, &sample);
+	if (metrics->path) {
+		metrics_write_prometheus(metrics, plane, &sample);
+	}
+	if (metrics->csv) {
+		metrics_write_csv(metrics->csv, &sample);
+	}
+}
+
+void coordinate_plane_metrics_update(coordinate_plane_metrics_s *metrics,
+				     coordinate_plane_s *plane,
+				     pixel_buffer_s *buf)
+{
+	if (!metrics->path && !metrics->csv) {
+		return;
+	}
+	uint64_t now = coordinate_plane_time_in_nsec();
+	if ((now - metrics->last_nsec) < metrics->interval_nsec) {
+		return;
+	}
+	coordinate_plane_metrics_write(metrics, plane, buf);
+}
+
+void coordinate_plane_metrics_close(coordinate_plane_metrics_s *metrics)
+{
+	if (metrics->csv) {
+		fclose(metrics->csv);
+		metrics->csv = NULL;
+	}
+}
@@ -0,0 +1,52 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* coord-plane-metrics.h: Prometheus text and CSV timeline of a plane */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#ifndef COORD_PLANE_METRICS_H
+#define COORD_PLANE_METRICS_H 1
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <coord-plane-iteration.h>
+#include <pixel-coord-plane-iteration.h>
+
+/*
+ Every interval the metrics file is rewritten in the Prometheus text
+ exposition format, for a node exporter textfile collector or similar
+ to pick up; it is written to a temporary file and renamed, so readers
+ never see half a file. The CSV timeline, if any, gains a row each
+ interval instead. The _total counters, and the frame _count, are the
+ lifetime counts of the plane, so they carry on across resets and
+ stats clears; the rates are over the interval just ended.
+*/
+typedef struct coordinate_plane_metrics {
+	const char *path;
+	FILE *csv;
+	uint64_t interval_nsec;
+	uint64_t start_nsec;
+	uint64_t last_nsec;
+	/* the plane's lifetime counts at the last write */
+	coordinate_plane_totals_s last;
+} coordinate_plane_metrics_s;
+
+/* either path may be NULL; returns 0 on success, or non-zero having
+   logged the path which could not be opened */
+int coordinate_plane_metrics_init(coordinate_plane_metrics_s *metrics,
+				  const char *path, const char *csv_path,
+				  uint32_t interval_sec);
+
+/* call each frame; writes only once the interval has passed. The
+   pixel buffer is optional, it adds to the memory reported */
+void coordinate_plane_metrics_update(coordinate_plane_metrics_s *metrics,
+				     coordinate_plane_s *plane,
+				     pixel_buffer_s *buf);
+
+/* writes now, as at exit */
+void coordinate_plane_metrics_write(coordinate_plane_metrics_s *metrics,
+				    coordinate_plane_s *plane,
+				    pixel_buffer_s *buf);
+
+void coordinate_plane_metrics_close(coordinate_plane_metrics_s *metrics);
+
+#endif /* COORD_PLANE_METRICS_H */
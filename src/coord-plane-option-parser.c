@@ -3,11 +3,18 @@
 /* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
 
 #include <coord-plane-option-parser.h>
+#include <errno.h>
 #include <math.h>
 #include <stdlib.h>
 #include <float.h>
 #include <getopt.h>
 #include <inttypes.h>
+#include <string.h>
+
+#include <logerr-die.h>
+#include <trace-events.h>
+#include <perf-counters.h>
+#include <pixel-coord-plane-iteration.h>
 
 #ifndef SKIP_THREADS
 #include <unistd.h>
@@ -17,9 +24,14 @@ void print_command_line(coordinate_plane_s *plane, FILE *out)
 {
 	const char *argv0 = coordinate_plane_program(plane);
 	size_t pfuncs_idx = coordinate_plane_function_index(plane);
+	const char *expr = coordinate_plane_function_expr_source(plane);
 
-	fprintf(out, "%s --function=%zu", argv0, pfuncs_idx);
-	if (pfuncs_idx == pfuncs_julia_idx) {
+	if (expr) {
+		fprintf(out, "%s --function_expr='%s'", argv0, expr);
+	} else {
+		fprintf(out, "%s --function=%zu", argv0, pfuncs_idx);
+	}
+	if (expr || pfuncs_idx == pfuncs_julia_idx) {
 		ldxy_s seed;
 		coordinate_plane_seed(plane, &seed);
 		fprintf(out, " --seed_x=%.*Lg --seed_y=%.*Lg", DECIMAL_DIG,
@@ -49,25 +61,6 @@ void print_command_line(coordinate_plane_s *plane, FILE *out)
 		DECIMAL_DIG, y_min, DECIMAL_DIG, y_max);
 }
 
-typedef struct coord_options {
-	int win_width;
-	int win_height;
-	long double x_min;
-	long double x_max;
-	long double y_min;
-	long double y_max;
-	long double center_x;
-	long double center_y;
-	long double seed_x;
-	long double seed_y;
-	int function;
-	int threads;
-	int halt_after;
-	int skip_rounds;
-	int version;
-	int help;
-} coord_options_s;
-
 static void coord_options_init(coord_options_s *options)
 {
 	options->win_width = -1;
@@ -79,11 +72,32 @@ static void coord_options_init(coord_options_s *options)
 	options->center_x = NAN;
 	options->center_y = NAN;
 	options->function = -1;
+	options->function_expr = NULL;
 	options->seed_x = NAN;
 	options->seed_y = NAN;
 	options->threads = -1;
 	options->halt_after = -1;
 	options->skip_rounds = -1;
+	options->fps = -1;
+	options->vsync = 0;
+	options->truecolor = 0;
+	options->batch = 0;
+	options->output = NULL;
+	options->heatmap = NULL;
+	options->trace = NULL;
+	options->perf_counters = 0;
+	options->async_log = 0;
+	options->max_memory = 0;
+	options->metrics = NULL;
+	options->metrics_csv = NULL;
+	options->metrics_interval = -1;
+	options->record = NULL;
+	options->replay = NULL;
+	options->replay_bench = 0;
+	options->headless = 0;
+	options->buddhabrot = 0;
+	options->nebula = 0;
+	options->importance = 0;
 	options->version = 0;
 	options->help = 0;
 }
@@ -148,6 +162,33 @@ static void coord_options_rationalize(coord_options_s *options)
 	if (options->skip_rounds < 0) {
 		options->skip_rounds = 0;
 	}
+	if (options->fps < 1) {
+		options->fps = 30;
+	}
+	if (options->vsync != 1) {
+		options->vsync = 0;
+	}
+	if (options->truecolor != 1) {
+		options->truecolor = 0;
+	}
+	if (options->batch != 1) {
+		options->batch = 0;
+	}
+	if (options->headless != 1) {
+		options->headless = 0;
+	}
+	if (options->replay_bench != 1) {
+		options->replay_bench = 0;
+	}
+	if (options->nebula != 1) {
+		options->nebula = 0;
+	}
+	if (options->importance != 1) {
+		options->importance = 0;
+	}
+	if (options->metrics_interval < 1) {
+		options->metrics_interval = 5;
+	}
 	if (options->threads < 1) {
 #ifndef SKIP_THREADS
 		options->threads = (uint32_t)sysconf(_SC_NPROCESSORS_ONLN);
@@ -160,6 +201,93 @@ static void coord_options_rationalize(coord_options_s *options)
 	}
 }
 
+/* a count of bytes, optionally followed by K, M or G for powers of 1024;
+   dies on anything else, or on a count too big for a size_t */
+static size_t parse_bytes(const char *str)
+{
+	char *end = NULL;
+	errno = 0;
+	unsigned long long count = strtoull(str, &end, 10);
+	if (end == str || strchr(str, '-') || errno == ERANGE) {
+		die("--max_memory=%s is not a count of bytes", str);
+	}
+	size_t shift = 0;
+	switch (*end) {
+	case 'g':
+	case 'G':
+		shift = 30;
+		++end;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		++end;
+		break;
+	case 'k':
+	case 'K':
+		shift = 10;
+		++end;
+		break;
+	default:
+		break;
+	}
+	if (*end != '\0') {
+		die("--max_memory=%s: unknown suffix '%s', not K, M or G", str,
+		    end);
+	}
+	if (count > (SIZE_MAX >> shift)) {
+		die("--max_memory=%s is too many bytes", str);
+	}
+	return ((size_t)count) << shift;
+}
+
+/* the plane and a pixel buffer for it, as the frontends make */
+static size_t coord_options_memory_needed(coord_options_s *options)
+{
+	size_t palette_len = 1024;
+	return coordinate_plane_memory_needed(options->win_width,
+					      options->win_height,
+					      options->threads,
+					      options->heatmap != NULL) +
+	    pixel_buffer_memory_needed(options->win_width,
+				       options->win_height, palette_len);
+}
+
+/* shrinks the window, keeping its shape, until it fits in max_memory */
+static void coord_options_fit_memory(coord_options_s *options)
+{
+	if (!options->max_memory) {
+		return;
+	}
+	size_t needed = coord_options_memory_needed(options);
+	if (needed <= options->max_memory) {
+		return;
+	}
+	int win_width = options->win_width;
+	int win_height = options->win_height;
+	while (needed > options->max_memory
+	       && (options->win_width > 1 || options->win_height > 1)) {
+		double scale = sqrt((1.0 * options->max_memory) / needed);
+		int width = (int)(options->win_width * scale);
+		int height = (int)(options->win_height * scale);
+		if (width == options->win_width
+		    && height == options->win_height) {
+			--width;
+			--height;
+		}
+		options->win_width = (width > 1) ? width : 1;
+		options->win_height = (height > 1) ? height : 1;
+		needed = coord_options_memory_needed(options);
+	}
+	if (needed > options->max_memory) {
+		die("--max_memory=%zu is less than the %zu bytes of a"
+		    " 1x1 window", options->max_memory, needed);
+	}
+	fprintf(stderr, "--max_memory=%zu: scaled %dx%d down to %dx%d"
+		" (%zu bytes)\n", options->max_memory, win_width,
+		win_height, options->win_width, options->win_height, needed);
+}
+
 static int coord_options_parse_argv(coord_options_s *options,
 				    int argc, char **argv, FILE *err)
 {
@@ -167,7 +295,8 @@ static int coord_options_parse_argv(coord_options_s *options,
 	int option_index;
 
 	/* yes, optstirng is horrible */
-	const char *optstring = "HVw:h:x:y:f:t:j:r:i:c:a:s:";
+	const char *optstring =
+	    "HVw:h:x:y:f:t:j:X:r:i:c:a:s:F:STbo:M:E:PAm:e:k:n:R:Y:BLu:NI";
 
 	struct option long_options[] = {
 		{ "help", no_argument, 0, 'H' },
@@ -179,11 +308,32 @@ static int coord_options_parse_argv(coord_options_s *options,
 		{ "from", required_argument, 0, 'f' },
 		{ "to", required_argument, 0, 't' },
 		{ "function", required_argument, 0, 'j' },
+		{ "function_expr", required_argument, 0, 'X' },
 		{ "seed_x", required_argument, 0, 'r' },
 		{ "seed_y", required_argument, 0, 'i' },
 		{ "threads", required_argument, 0, 'c' },
 		{ "halt_after", required_argument, 0, 'a' },
 		{ "skip_rounds", required_argument, 0, 's' },
+		{ "fps", required_argument, 0, 'F' },
+		{ "vsync", no_argument, 0, 'S' },
+		{ "truecolor", no_argument, 0, 'T' },
+		{ "batch", no_argument, 0, 'b' },
+		{ "output", required_argument, 0, 'o' },
+		{ "heatmap", required_argument, 0, 'M' },
+		{ "trace", required_argument, 0, 'E' },
+		{ "perf_counters", no_argument, 0, 'P' },
+		{ "async_log", no_argument, 0, 'A' },
+		{ "max_memory", required_argument, 0, 'm' },
+		{ "metrics", required_argument, 0, 'e' },
+		{ "metrics_csv", required_argument, 0, 'k' },
+		{ "metrics_interval", required_argument, 0, 'n' },
+		{ "record", required_argument, 0, 'R' },
+		{ "replay", required_argument, 0, 'Y' },
+		{ "replay_bench", no_argument, 0, 'B' },
+		{ "headless", no_argument, 0, 'L' },
+		{ "buddhabrot", required_argument, 0, 'u' },
+		{ "nebula", no_argument, 0, 'N' },
+		{ "importance", no_argument, 0, 'I' },
 		{ 0, 0, 0, 0 }
 	};
 
@@ -229,6 +379,9 @@ static int coord_options_parse_argv(coord_options_s *options,
 		case 'j':	/* --function | -j */
 			options->function = atoi(optarg);
 			break;
+		case 'X':	/* --function_expr | -X */
+			options->function_expr = optarg;
+			break;
 		case 'r':	/* --seed_x | -r */
 			options->seed_x = strtold(optarg, NULL);
 			break;
@@ -244,6 +397,68 @@ static int coord_options_parse_argv(coord_options_s *options,
 		case 's':	/* --skip_rounds | -s */
 			options->skip_rounds = atoi(optarg);
 			break;
+		case 'F':	/* --fps | -F */
+			options->fps = atoi(optarg);
+			break;
+		case 'S':	/* --vsync | -S */
+			options->vsync = 1;
+			break;
+		case 'T':	/* --truecolor | -T */
+			options->truecolor = 1;
+			break;
+		case 'b':	/* --batch | -b */
+			options->batch = 1;
+			break;
+		case 'o':	/* --output | -o */
+			options->output = optarg;
+			break;
+		case 'M':	/* --heatmap | -M */
+			options->heatmap = optarg;
+			break;
+		case 'E':	/* --trace | -E */
+			options->trace = optarg;
+			break;
+		case 'P':	/* --perf_counters | -P */
+			options->perf_counters = 1;
+			break;
+		case 'A':	/* --async_log | -A */
+			options->async_log = 1;
+			break;
+		case 'm':	/* --max_memory | -m */
+			options->max_memory = parse_bytes(optarg);
+			break;
+		case 'e':	/* --metrics | -e */
+			options->metrics = optarg;
+			break;
+		case 'k':	/* --metrics_csv | -k */
+			options->metrics_csv = optarg;
+			break;
+		case 'n':	/* --metrics_interval | -n */
+			options->metrics_interval = atoi(optarg);
+			break;
+		case 'R':	/* --record | -R */
+			options->record = optarg;
+			break;
+		case 'Y':	/* --replay | -Y */
+			options->replay = optarg;
+			break;
+		case 'B':	/* --replay_bench | -B */
+			options->replay_bench = 1;
+			break;
+		case 'L':	/* --headless | -L */
+			options->headless = 1;
+			break;
+		case 'u':	/* --buddhabrot | -u */
+			/* strtod, so that '1e8' may be used */
+			options->buddhabrot =
+			    (uint64_t)fabs(strtod(optarg, NULL));
+			break;
+		case 'N':	/* --nebula | -N */
+			options->nebula = 1;
+			break;
+		case 'I':	/* --importance | -I */
+			options->importance = 1;
+			break;
 		default:
 			options->help = 1;
 			fprintf(err, "unrecognized option: '%c'\n", opt_char);
@@ -270,8 +485,19 @@ void print_help(FILE *out, const char *argv0, const char *version)
 	fprintf(out, "\t-t --to=f          Right of the x-axis\n");
 	fprintf(out, "\t                           default is '1.5'\n");
 	fprintf(out, "\t-j --function=n    Function number\n");
-	fprintf(out, "\t                           0 for Mandlebrot\n");
-	fprintf(out, "\t                           1 for Julia\n");
+	for (size_t i = 0; i < pfuncs_len; ++i) {
+		fprintf(out, "\t                           %2zu for %s\n", i,
+			pfuncs[i].name);
+	}
+	fprintf(out, "\t                           multibrot is of degree\n");
+	fprintf(out, "\t                           3 to 5 only; others by\n");
+	fprintf(out, "\t                           -X 'z^d + c'\n");
+	fprintf(out, "\t-X --function_expr=s\n");
+	fprintf(out, "\t                           a formula in place of\n");
+	fprintf(out, "\t                           --function, of z, c,\n");
+	fprintf(out, "\t                           seed, i, + - * / ^n,\n");
+	fprintf(out, "\t                           conj() and abs()\n");
+	fprintf(out, "\t                           e.g. 'z^3 + c*z + seed'\n");
 	fprintf(out, "\t-r --seed_x=f      Real (x) part of the Julia seed\n");
 	fprintf(out, "\t-i --seed_y=f      Imaginary (y) part of the seed\n");
 #ifndef SKIP_THREADS
@@ -281,17 +507,66 @@ void print_help(FILE *out, const char *argv0, const char *version)
 #endif
 	fprintf(out, "\t-a --halt_after=n  Execute this many iterations\n");
 	fprintf(out, "\t-s --skip_rounds=n Number of iterations left black\n");
+	fprintf(out, "\t-F --fps=n         Target frames per second\n");
+#ifndef NO_GUI
+	fprintf(out, "\t-S --vsync         Present frames in step with vsync\n");
+	fprintf(out, "\t-R --record=file   Record the input of each frame\n");
+	fprintf(out, "\t-Y --replay=file   Replay a recording, paced as\n");
+	fprintf(out, "\t                           recorded; use the same\n");
+	fprintf(out, "\t                           options, see its header\n");
+	fprintf(out, "\t-B --replay_bench  Replay as fast as possible\n");
+	fprintf(out, "\t-L --headless      No display, software renderer,\n");
+	fprintf(out, "\t                           runs --halt_after, or\n");
+	fprintf(out, "\t                           --replay, or 1000 frames\n");
+	fprintf(out, "\t                           then prints frame times\n");
+#else
+	fprintf(out, "\t-T --truecolor     24-bit color half-block terminal\n");
+	fprintf(out, "\t-b --batch         Run --halt_after iterations,\n");
+	fprintf(out, "\t                           print only the final result\n");
+	fprintf(out, "\t-o --output=file   Write the final result as PPM\n");
+	fprintf(out, "\t-M --heatmap=file  Record steps spent per point,\n");
+	fprintf(out, "\t                           write them as PPM at exit\n");
+	fprintf(out, "\t-u --buddhabrot=n  Orbit density of n samples (1e8)\n");
+	fprintf(out, "\t                           to --output, rewritten\n");
+	fprintf(out, "\t                           as it refines; orbits\n");
+	fprintf(out, "\t                           of --halt_after or 1000\n");
+	fprintf(out, "\t-N --nebula        Red, green, blue orbits of\n");
+	fprintf(out, "\t                           1, 1/10, 1/100 the limit\n");
+	fprintf(out, "\t-I --importance    Resample where long orbits were\n");
+#endif
+	fprintf(out, "\t-E --trace=file    Chrome trace-event JSON, written\n");
+	fprintf(out, "\t                           at exit and on SIGUSR1\n");
+	fprintf(out, "\t-P --perf_counters Hardware counters by phase,\n");
+	fprintf(out, "\t                           summary at exit (Linux)\n");
+	fprintf(out, "\t-A --async_log     Log through per-thread rings and\n");
+	fprintf(out, "\t                           a drain thread, so that\n");
+	fprintf(out, "\t                           workers never block on\n");
+	fprintf(out, "\t                           stderr\n");
+	fprintf(out, "\t-m --max_memory=n  Bytes (nK, nM, nG) for plane and\n");
+	fprintf(out, "\t                           pixels; the window is\n");
+	fprintf(out, "\t                           scaled down to fit\n");
+	fprintf(out, "\t-e --metrics=file  Prometheus text, rewritten each\n");
+	fprintf(out, "\t                           --metrics_interval\n");
+	fprintf(out, "\t-k --metrics_csv=f A row of the same metrics, each\n");
+	fprintf(out, "\t                           --metrics_interval\n");
+	fprintf(out, "\t-n --metrics_interval=n\n");
+	fprintf(out, "\t                           seconds, default is '5'\n");
 	fprintf(out, "\t-v --version       Print version and exit\n");
 	fprintf(out, "\t-h --help          This message and exit\n");
 }
 
 coordinate_plane_s *coordinate_plane_new_from_args(int argc, char **argv,
-						   const char *version)
+						   const char *version,
+						   coord_options_s *out)
 {
 	coord_options_s options;
 	coord_options_init(&options);
 	coord_options_parse_argv(&options, argc, argv, stdout);
 	coord_options_rationalize(&options);
+	coord_options_fit_memory(&options);
+	if (out) {
+		*out = options;
+	}
 
 	if (options.help) {
 		print_help(stdout, argv[0], version);
@@ -303,6 +578,18 @@ coordinate_plane_s *coordinate_plane_new_from_args(int argc, char **argv,
 		exit(EXIT_SUCCESS);
 	}
 
+	/* failing that, logging stays synchronous */
+	if (options.async_log) {
+		logerr_async_start();
+	}
+
+	if (options.trace && trace_events_start(options.trace)) {
+		die("could not start tracing to '%s'", options.trace);
+	}
+	if (options.perf_counters) {
+		perf_counters_start();
+	}
+
 	ldxy_s seed = { options.seed_x, options.seed_y };
 	ldxy_s center = { options.center_x, options.center_y };
 	long double resolution_x =
@@ -317,5 +604,13 @@ coordinate_plane_s *coordinate_plane_new_from_args(int argc, char **argv,
 				 options.halt_after, options.skip_rounds,
 				 options.threads);
 
+	if (options.function_expr) {
+		char err[256];
+		if (coordinate_plane_function_expr(plane, options.function_expr,
+						   err, sizeof(err))) {
+			die("--function_expr: %s", err);
+		}
+	}
+
 	return plane;
 }
@@ -9,9 +9,51 @@
 
 #include <coord-plane-iteration.h>
 
+typedef struct coord_options {
+	int win_width;
+	int win_height;
+	long double x_min;
+	long double x_max;
+	long double y_min;
+	long double y_max;
+	long double center_x;
+	long double center_y;
+	long double seed_x;
+	long double seed_y;
+	int function;
+	const char *function_expr;
+	int threads;
+	int halt_after;
+	int skip_rounds;
+	int fps;
+	int vsync;
+	int truecolor;
+	int batch;
+	const char *output;
+	const char *heatmap;
+	const char *trace;
+	int perf_counters;
+	int async_log;
+	const char *metrics;
+	const char *metrics_csv;
+	int metrics_interval;
+	int headless;
+	const char *record;
+	const char *replay;
+	int replay_bench;
+	uint64_t buddhabrot;
+	int nebula;
+	int importance;
+	/* bytes, zero for no limit */
+	size_t max_memory;
+	int version;
+	int help;
+} coord_options_s;
+
 void print_help(FILE *out, const char *argv0, const char *version);
 coordinate_plane_s *coordinate_plane_new_from_args(int argc, char **argv,
-						   const char *version);
+						   const char *version,
+						   coord_options_s *out);
 void print_command_line(coordinate_plane_s *plane, FILE *out);
 
 #endif /* COORD_PLANE_OPTION_PARSER_H */
@@ -0,0 +1,200 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* coord-plane-render.c: batch rendering of escape counts */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#include <assert.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifndef SKIP_THREADS
+#include <stdatomic.h>
+#include <unistd.h>
+#include <basic-thread-pool.h>
+#endif
+
+#include <alloc-or-die.h>
+#include <coord-plane-render.h>
+
+struct coordinate_plane_renderer {
+#ifndef SKIP_THREADS
+	basic_thread_pool_s *tpool;
+#else
+	void *tpool;
+#endif
+	uint32_t num_threads;
+};
+
+struct coordinate_plane_render_job {
+	coordinate_plane_renderer_s *renderer;
+	coordinate_plane_view_s view;
+	uint32_t width;
+	uint32_t height;
+	uint32_t *out;
+	int result;
+#ifndef SKIP_THREADS
+	atomic_bool done;
+#else
+	bool done;
+#endif
+};
+
+coordinate_plane_renderer_s *coordinate_plane_renderer_new(uint32_t
+							   num_threads)
+{
+	coordinate_plane_renderer_s *renderer = NULL;
+	size_t size = sizeof(coordinate_plane_renderer_s);
+	alloc_or_die(&renderer, size);
+	memset(renderer, 0x00, size);
+
+#ifndef SKIP_THREADS
+	if (!num_threads) {
+		long nproc = sysconf(_SC_NPROCESSORS_ONLN);
+		num_threads = (nproc > 0) ? (uint32_t)nproc : 1;
+	}
+	renderer->tpool = basic_thread_pool_new(num_threads);
+	if (!renderer->tpool) {
+		free(renderer);
+		return NULL;
+	}
+#else
+	num_threads = 1;
+#endif
+	renderer->num_threads = num_threads;
+
+	return renderer;
+}
+
+void coordinate_plane_renderer_free(coordinate_plane_renderer_s *renderer)
+{
+	if (!renderer) {
+		return;
+	}
+#ifndef SKIP_THREADS
+	if (renderer->tpool) {
+		basic_thread_pool_stop_and_free(&(renderer->tpool));
+	}
+#endif
+	free(renderer);
+}
+
+static int coordinate_plane_view_invalid(const coordinate_plane_view_s *view,
+					 uint32_t width, uint32_t height,
+					 uint32_t *out)
+{
+	if (!view || !out || !width || !height) {
+		return 1;
+	}
+	if (view->pfuncs_idx >= pfuncs_len) {
+		return 1;
+	}
+	if (!(view->resolution_x > 0.0) || !(view->resolution_y > 0.0)) {
+		return 1;
+	}
+	return 0;
+}
+
+int coordinate_plane_render(coordinate_plane_renderer_s *renderer,
+			    const coordinate_plane_view_s *view,
+			    uint32_t width, uint32_t height, uint32_t *out)
+{
+	assert(renderer);
+	if (coordinate_plane_view_invalid(view, width, height, out)) {
+		return 1;
+	}
+
+	const char *program_name = "libcoordplane";
+	uint64_t halt_after = view->iterations;
+	uint32_t skip_rounds = 0;
+	coordinate_plane_s *plane =
+	    coordinate_plane_new(program_name, width, height, view->center,
+				 view->resolution_x, view->resolution_y,
+				 view->pfuncs_idx, view->seed, halt_after,
+				 skip_rounds, renderer->num_threads);
+#ifndef SKIP_THREADS
+	coordinate_plane_share_thread_pool(plane, renderer->tpool);
+#endif
+
+	uint64_t remaining = view->iterations;
+	while (remaining) {
+		uint32_t steps = (remaining > UINT32_MAX) ? UINT32_MAX :
+		    (uint32_t)remaining;
+		coordinate_plane_iterate(plane, steps);
+		remaining -= steps;
+	}
+
+	size_t out_stride = width;
+	coordinate_plane_escaped_region(plane, NULL, out, out_stride);
+
+	coordinate_plane_free(plane);
+
+	return 0;
+}
+
+static int coordinate_plane_render_job_run(void *arg)
+{
+	coordinate_plane_render_job_s *job = arg;
+	job->result =
+	    coordinate_plane_render(job->renderer, &job->view, job->width,
+				    job->height, job->out);
+	job->done = true;
+	return job->result;
+}
+
+coordinate_plane_render_job_s
+    *coordinate_plane_render_async(coordinate_plane_renderer_s *renderer,
+				   const coordinate_plane_view_s *view,
+				   uint32_t width, uint32_t height,
+				   uint32_t *out)
+{
+	assert(renderer);
+	if (coordinate_plane_view_invalid(view, width, height, out)) {
+		return NULL;
+	}
+
+	coordinate_plane_render_job_s *job = NULL;
+	size_t size = sizeof(coordinate_plane_render_job_s);
+	alloc_or_die(&job, size);
+	job->renderer = renderer;
+	job->view = *view;
+	job->width = width;
+	job->height = height;
+	job->out = out;
+	job->result = 0;
+	job->done = false;
+
+#ifndef SKIP_THREADS
+	thrd_start_t func = coordinate_plane_render_job_run;
+	if (basic_thread_pool_add(renderer->tpool, func, job)) {
+		free(job);
+		return NULL;
+	}
+#else
+	coordinate_plane_render_job_run(job);
+#endif
+	return job;
+}
+
+bool coordinate_plane_render_job_done(coordinate_plane_render_job_s *job)
+{
+	return job->done;
+}
+
+int coordinate_plane_render_job_wait(coordinate_plane_render_job_s **job_ref)
+{
+	coordinate_plane_render_job_s *job = *job_ref;
+	assert(job);
+
+	while (!job->done) {
+#ifndef SKIP_THREADS
+		if (!basic_thread_pool_help(job->renderer->tpool)) {
+			thrd_yield();
+		}
+#endif
+	}
+
+	int result = job->result;
+	free(job);
+	*job_ref = NULL;
+	return result;
+}
@@ -0,0 +1,57 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* coord-plane-render.h: batch rendering of escape counts */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#ifndef COORD_PLANE_RENDER_H
+#define COORD_PLANE_RENDER_H 1
+
+#include <coord-plane-iteration.h>
+
+/*
+ A renderer owns one thread pool which is shared by every render made
+ with it, from any number of calling threads at once. Each render uses
+ a private coordinate_plane_s, so renders do not share mutable state.
+*/
+struct coordinate_plane_renderer;
+typedef struct coordinate_plane_renderer coordinate_plane_renderer_s;
+
+struct coordinate_plane_render_job;
+typedef struct coordinate_plane_render_job coordinate_plane_render_job_s;
+
+typedef struct coordinate_plane_view {
+	ldxy_s center;
+	long double resolution_x;
+	long double resolution_y;
+	size_t pfuncs_idx;
+	ldxy_s seed;
+	uint64_t iterations;
+} coordinate_plane_view_s;
+
+/* num_threads of zero means one per online processor */
+coordinate_plane_renderer_s *coordinate_plane_renderer_new(uint32_t
+							   num_threads);
+
+void coordinate_plane_renderer_free(coordinate_plane_renderer_s *renderer);
+
+/* fills out (width * height, row-major) with escape counts, zero for
+   points which did not escape; returns 0 on success */
+int coordinate_plane_render(coordinate_plane_renderer_s *renderer,
+			    const coordinate_plane_view_s *view,
+			    uint32_t width, uint32_t height, uint32_t *out);
+
+/* as above, but returns at once; out must stay valid until the job has
+   been waited on. Returns NULL if the job could not be queued */
+coordinate_plane_render_job_s
+    *coordinate_plane_render_async(coordinate_plane_renderer_s *renderer,
+				   const coordinate_plane_view_s *view,
+				   uint32_t width, uint32_t height,
+				   uint32_t *out);
+
+bool coordinate_plane_render_job_done(coordinate_plane_render_job_s *job);
+
+/* blocks (helping with queued work) until the job is done, frees it and
+   sets *job_ref to NULL; returns what coordinate_plane_render would */
+int coordinate_plane_render_job_wait(coordinate_plane_render_job_s **job_ref);
+
+#endif /* COORD_PLANE_RENDER_H */
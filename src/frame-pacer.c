@@ -0,0 +1,92 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* frame-pacer.c: iterations per frame from a frame time budget */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#include <time.h>
+
+#include <frame-pacer.h>
+
+uint64_t time_in_usec(void)
+{
+	struct timespec ts = { 0, 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t usec_per_sec = (1000 * 1000);
+	return (usec_per_sec * ts.tv_sec) + (ts.tv_nsec / 1000);
+}
+
+void frame_pacer_init(frame_pacer_s *pacer, uint32_t frames_per_second)
+{
+	uint64_t usec_per_sec = (1000 * 1000);
+	frames_per_second = frames_per_second ? frames_per_second : 1;
+	pacer->target_usec = usec_per_sec / frames_per_second;
+
+	/* ki of 1.0 would be dead-beat on a noiseless plant, 0.5 halves
+	   the error each frame without overshoot; kp damps sudden jumps */
+	pacer->kp = 0.2;
+	pacer->ki = 0.5;
+	pacer->smoothing = 0.25;
+	pacer->max_ipf = (1 << 24);
+
+	pacer->overhead_usec = 0.0;
+	frame_pacer_reset(pacer);
+}
+
+void frame_pacer_reset(frame_pacer_s *pacer)
+{
+	/* the next frame measures the new view's cost afresh; the overhead
+	   of drawing a frame does not depend on the view, so it is kept */
+	pacer->usec_per_it = 0.0;
+	pacer->last_error = 0.0;
+	pacer->ipf = 1.0;
+	pacer->it_per_frame = 1;
+}
+
+uint32_t frame_pacer_update(frame_pacer_s *pacer, uint32_t iterations,
+			    uint64_t compute_usec, uint64_t overhead_usec)
+{
+	double a = pacer->smoothing;
+
+	if (pacer->overhead_usec > 0.0) {
+		pacer->overhead_usec =
+		    (a * overhead_usec) + ((1.0 - a) * pacer->overhead_usec);
+	} else {
+		pacer->overhead_usec = overhead_usec;
+	}
+
+	if (!iterations) {
+		/* halted; nothing was measured */
+		return pacer->it_per_frame;
+	}
+
+	/* a clock tick of zero would make the cost appear free */
+	double usec_per_it = (compute_usec ? compute_usec : 1) /
+	    (1.0 * iterations);
+	if (pacer->usec_per_it > 0.0) {
+		pacer->usec_per_it =
+		    (a * usec_per_it) + ((1.0 - a) * pacer->usec_per_it);
+	} else {
+		pacer->usec_per_it = usec_per_it;
+	}
+
+	double budget = pacer->target_usec - pacer->overhead_usec;
+	double min_budget = pacer->target_usec / 10.0;
+	if (budget < min_budget) {
+		budget = min_budget;
+	}
+
+	double error = (budget - compute_usec) / pacer->usec_per_it;
+	double delta_error = error - pacer->last_error;
+	pacer->last_error = error;
+
+	pacer->ipf += (pacer->kp * delta_error) + (pacer->ki * error);
+
+	/* clamping is also the anti-windup */
+	if (pacer->ipf < 1.0) {
+		pacer->ipf = 1.0;
+	} else if (pacer->ipf > pacer->max_ipf) {
+		pacer->ipf = pacer->max_ipf;
+	}
+	pacer->it_per_frame = (uint32_t)(pacer->ipf + 0.5);
+
+	return pacer->it_per_frame;
+}
@@ -0,0 +1,44 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* frame-pacer.h: iterations per frame from a frame time budget */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H 1
+
+#include <stdint.h>
+
+/*
+ A PI controller over iterations-per-frame (ipf).
+
+ Each frame reports how many iterations were computed, how long that
+ took, and how long the rest of the frame (colorize, upload, draw) took,
+ not counting any wait for vsync. The compute budget is the target frame
+ time less the smoothed overhead; the error is how many iterations more
+ (or fewer) would have fit in that budget at the smoothed cost per
+ iteration.
+*/
+typedef struct frame_pacer {
+	uint64_t target_usec;
+	double kp;
+	double ki;
+	double smoothing;
+	double usec_per_it;
+	double overhead_usec;
+	double last_error;
+	double ipf;
+	double max_ipf;
+	uint32_t it_per_frame;
+} frame_pacer_s;
+
+void frame_pacer_init(frame_pacer_s *pacer, uint32_t frames_per_second);
+
+/* call when the view changes, the old cost per iteration is stale */
+void frame_pacer_reset(frame_pacer_s *pacer);
+
+uint32_t frame_pacer_update(frame_pacer_s *pacer, uint32_t iterations,
+			    uint64_t compute_usec, uint64_t overhead_usec);
+
+/* monotonic clock, microseconds */
+uint64_t time_in_usec(void);
+
+#endif /* FRAME_PACER_H */
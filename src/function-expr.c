@@ -0,0 +1,472 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* function-expr.c: iteration functions from a formula, as bytecode */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#include <assert.h>
+#include <ctype.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <alloc-or-die.h>
+#include <function-expr.h>
+
+/*
+ Registers 0 to 2 are z, c and seed; temporaries count up from 3 and
+ constants count down from the top. The recursive descent parser hands
+ back the register holding each sub-expression; temporaries are used
+ as a stack, so an operator writes over the lower of its operands.
+*/
+#define function_expr_first_temp 3
+#define function_expr_ops_max 256
+#define function_expr_max_exponent 64
+
+enum function_expr_code {
+	function_expr_mov,
+	function_expr_add,
+	function_expr_sub,
+	function_expr_mul,
+	function_expr_div,
+	function_expr_neg,
+	function_expr_conj,
+	function_expr_abs
+};
+
+typedef struct function_expr_op {
+	uint8_t code;
+	uint8_t dst;
+	uint8_t a;
+	uint8_t b;
+} function_expr_op_s;
+
+struct function_expr {
+	char *source;
+	function_expr_op_s ops[function_expr_ops_max];
+	size_t ops_len;
+	/* constants fill registers [const_floor, function_expr_registers) */
+	uint8_t const_floor;
+	double const_re[function_expr_registers];
+	double const_im[function_expr_registers];
+};
+
+typedef struct function_expr_parser {
+	function_expr_s *expr;
+	const char *pos;
+	uint8_t next_temp;
+	char *err;
+	size_t err_len;
+	bool failed;
+} function_expr_parser_s;
+
+static void parser_fail(function_expr_parser_s *p, const char *msg)
+{
+	if (p->failed) {
+		return;
+	}
+	p->failed = true;
+	size_t column = 1 + (p->pos - p->expr->source);
+	if (p->err && p->err_len) {
+		snprintf(p->err, p->err_len, "%s at column %zu of '%s'", msg,
+			 column, p->expr->source);
+	}
+}
+
+static void parser_skip_space(function_expr_parser_s *p)
+{
+	while (isspace((unsigned char)*p->pos)) {
+		++p->pos;
+	}
+}
+
+static bool parser_accept(function_expr_parser_s *p, char c)
+{
+	parser_skip_space(p);
+	if (*p->pos != c) {
+		return false;
+	}
+	++p->pos;
+	return true;
+}
+
+static bool is_temp(function_expr_parser_s *p, uint8_t reg)
+{
+	return reg >= function_expr_first_temp && reg < p->expr->const_floor;
+}
+
+static uint8_t alloc_temp(function_expr_parser_s *p)
+{
+	if (p->next_temp >= p->expr->const_floor) {
+		parser_fail(p, "formula needs too many registers");
+		return function_expr_reg_z;
+	}
+	return p->next_temp++;
+}
+
+static uint8_t alloc_const(function_expr_parser_s *p, double re, double im)
+{
+	function_expr_s *expr = p->expr;
+	if (expr->const_floor <= p->next_temp) {
+		parser_fail(p, "formula has too many constants");
+		return function_expr_reg_z;
+	}
+	uint8_t reg = --expr->const_floor;
+	expr->const_re[reg] = re;
+	expr->const_im[reg] = im;
+	return reg;
+}
+
+static void emit(function_expr_parser_s *p, enum function_expr_code code,
+		 uint8_t dst, uint8_t a, uint8_t b)
+{
+	function_expr_s *expr = p->expr;
+	if (expr->ops_len >= function_expr_ops_max) {
+		parser_fail(p, "formula is too long");
+		return;
+	}
+	function_expr_op_s *op = expr->ops + expr->ops_len++;
+	op->code = code;
+	op->dst = dst;
+	op->a = a;
+	op->b = b;
+}
+
+/* temporaries are a stack, so the lower of the two is reused */
+static uint8_t emit_binary(function_expr_parser_s *p,
+			   enum function_expr_code code, uint8_t a, uint8_t b)
+{
+	uint8_t dst;
+	if (is_temp(p, a) && is_temp(p, b)) {
+		dst = (a < b) ? a : b;
+		p->next_temp = dst + 1;
+	} else if (is_temp(p, a)) {
+		dst = a;
+	} else if (is_temp(p, b)) {
+		dst = b;
+	} else {
+		dst = alloc_temp(p);
+	}
+	emit(p, code, dst, a, b);
+	return dst;
+}
+
+static uint8_t emit_unary(function_expr_parser_s *p,
+			  enum function_expr_code code, uint8_t a)
+{
+	uint8_t dst = is_temp(p, a) ? a : alloc_temp(p);
+	emit(p, code, dst, a, a);
+	return dst;
+}
+
+/* square and multiply, from the highest bit down, all at compile time */
+static uint8_t emit_power(function_expr_parser_s *p, uint8_t base,
+			  unsigned long n)
+{
+	if (n == 0) {
+		if (is_temp(p, base)) {
+			p->next_temp = base;
+		}
+		return alloc_const(p, 1.0, 0.0);
+	}
+	if (n == 1) {
+		return base;
+	}
+	uint8_t t = alloc_temp(p);
+	emit(p, function_expr_mov, t, base, base);
+	unsigned long bit = 1;
+	while ((bit << 1) <= n) {
+		bit <<= 1;
+	}
+	for (bit >>= 1; bit; bit >>= 1) {
+		emit(p, function_expr_mul, t, t, t);
+		if (n & bit) {
+			emit(p, function_expr_mul, t, t, base);
+		}
+	}
+	if (!is_temp(p, base)) {
+		return t;
+	}
+	emit(p, function_expr_mov, base, t, t);
+	p->next_temp = base + 1;
+	return base;
+}
+
+static uint8_t parse_sum(function_expr_parser_s *p);
+
+static uint8_t parse_name(function_expr_parser_s *p)
+{
+	const char *start = p->pos;
+	while (isalpha((unsigned char)*p->pos)) {
+		++p->pos;
+	}
+	size_t len = p->pos - start;
+
+	if (len == 1 && *start == 'z') {
+		return function_expr_reg_z;
+	} else if (len == 1 && *start == 'c') {
+		return function_expr_reg_c;
+	} else if (len == 4 && strncmp(start, "seed", len) == 0) {
+		return function_expr_reg_seed;
+	} else if (len == 1 && *start == 'i') {
+		return alloc_const(p, 0.0, 1.0);
+	}
+
+	enum function_expr_code code;
+	if (len == 4 && strncmp(start, "conj", len) == 0) {
+		code = function_expr_conj;
+	} else if (len == 3 && strncmp(start, "abs", len) == 0) {
+		code = function_expr_abs;
+	} else {
+		p->pos = start;
+		parser_fail(p, "unknown name");
+		return function_expr_reg_z;
+	}
+	if (!parser_accept(p, '(')) {
+		parser_fail(p, "expected '('");
+		return function_expr_reg_z;
+	}
+	uint8_t arg = parse_sum(p);
+	if (!parser_accept(p, ')')) {
+		parser_fail(p, "expected ')'");
+	}
+	return emit_unary(p, code, arg);
+}
+
+static uint8_t parse_primary(function_expr_parser_s *p)
+{
+	parser_skip_space(p);
+	if (parser_accept(p, '(')) {
+		uint8_t reg = parse_sum(p);
+		if (!parser_accept(p, ')')) {
+			parser_fail(p, "expected ')'");
+		}
+		return reg;
+	}
+	if (isdigit((unsigned char)*p->pos) || *p->pos == '.') {
+		char *end = NULL;
+		double value = strtod(p->pos, &end);
+		if (end == p->pos) {
+			parser_fail(p, "expected a number");
+			return function_expr_reg_z;
+		}
+		p->pos = end;
+		/* 0.5i, but not 0.5 * i written as "0.5in" or the like */
+		if (*p->pos == 'i' && !isalpha((unsigned char)p->pos[1])) {
+			++p->pos;
+			return alloc_const(p, 0.0, value);
+		}
+		return alloc_const(p, value, 0.0);
+	}
+	if (isalpha((unsigned char)*p->pos)) {
+		return parse_name(p);
+	}
+	parser_fail(p, *p->pos ? "unexpected character" : "unexpected end");
+	return function_expr_reg_z;
+}
+
+static uint8_t parse_power(function_expr_parser_s *p)
+{
+	uint8_t base = parse_primary(p);
+	if (!parser_accept(p, '^')) {
+		return base;
+	}
+	parser_skip_space(p);
+	if (!isdigit((unsigned char)*p->pos)) {
+		parser_fail(p, "expected a whole number exponent");
+		return base;
+	}
+	char *end = NULL;
+	unsigned long n = strtoul(p->pos, &end, 10);
+	if (n > function_expr_max_exponent) {
+		parser_fail(p, "exponent is too large");
+		return base;
+	}
+	p->pos = end;
+	return emit_power(p, base, n);
+}
+
+static uint8_t parse_unary(function_expr_parser_s *p)
+{
+	if (parser_accept(p, '-')) {
+		return emit_unary(p, function_expr_neg, parse_unary(p));
+	}
+	if (parser_accept(p, '+')) {
+		return parse_unary(p);
+	}
+	return parse_power(p);
+}
+
+static uint8_t parse_product(function_expr_parser_s *p)
+{
+	uint8_t reg = parse_unary(p);
+	while (!p->failed) {
+		enum function_expr_code code;
+		if (parser_accept(p, '*')) {
+			code = function_expr_mul;
+		} else if (parser_accept(p, '/')) {
+			code = function_expr_div;
+		} else {
+			break;
+		}
+		reg = emit_binary(p, code, reg, parse_unary(p));
+	}
+	return reg;
+}
+
+static uint8_t parse_sum(function_expr_parser_s *p)
+{
+	uint8_t reg = parse_product(p);
+	while (!p->failed) {
+		enum function_expr_code code;
+		if (parser_accept(p, '+')) {
+			code = function_expr_add;
+		} else if (parser_accept(p, '-')) {
+			code = function_expr_sub;
+		} else {
+			break;
+		}
+		reg = emit_binary(p, code, reg, parse_product(p));
+	}
+	return reg;
+}
+
+function_expr_s *function_expr_compile(const char *source, char *err,
+				       size_t err_len)
+{
+	assert(source);
+	function_expr_s *expr = NULL;
+	size_t size = sizeof(function_expr_s);
+	alloc_or_die(&expr, size);
+	memset(expr, 0x00, size);
+	size = strlen(source) + 1;
+	alloc_or_die(&expr->source, size);
+	memcpy(expr->source, source, size);
+	expr->const_floor = function_expr_registers;
+
+	function_expr_parser_s parser;
+	parser.expr = expr;
+	parser.pos = expr->source;
+	parser.next_temp = function_expr_first_temp;
+	parser.err = err;
+	parser.err_len = err_len;
+	parser.failed = false;
+
+	uint8_t result = parse_sum(&parser);
+	parser_skip_space(&parser);
+	if (*parser.pos) {
+		parser_fail(&parser, "unexpected character");
+	}
+	if (result != function_expr_reg_z) {
+		emit(&parser, function_expr_mov, function_expr_reg_z, result,
+		     result);
+	}
+	if (parser.failed) {
+		function_expr_free(expr);
+		return NULL;
+	}
+	return expr;
+}
+
+void function_expr_free(function_expr_s *expr)
+{
+	if (!expr) {
+		return;
+	}
+	free(expr->source);
+	free(expr);
+}
+
+const char *function_expr_source(const function_expr_s *expr)
+{
+	return expr->source;
+}
+
+size_t function_expr_length(const function_expr_s *expr)
+{
+	return expr->ops_len;
+}
+
+void function_expr_load(const function_expr_s *expr, function_expr_vm_s *vm)
+{
+	for (size_t r = expr->const_floor; r < function_expr_registers; ++r) {
+		for (size_t l = 0; l < vm->len; ++l) {
+			vm->re[r][l] = expr->const_re[r];
+			vm->im[r][l] = expr->const_im[r];
+		}
+	}
+}
+
+void function_expr_step(const function_expr_s *expr, function_expr_vm_s *vm)
+{
+	size_t len = vm->len;
+	for (size_t i = 0; i < expr->ops_len; ++i) {
+		const function_expr_op_s *op = expr->ops + i;
+		double *d_re = vm->re[op->dst];
+		double *d_im = vm->im[op->dst];
+		const double *a_re = vm->re[op->a];
+		const double *a_im = vm->im[op->a];
+		const double *b_re = vm->re[op->b];
+		const double *b_im = vm->im[op->b];
+		switch (op->code) {
+		case function_expr_mov:
+			for (size_t l = 0; l < len; ++l) {
+				d_re[l] = a_re[l];
+				d_im[l] = a_im[l];
+			}
+			break;
+		case function_expr_add:
+			for (size_t l = 0; l < len; ++l) {
+				d_re[l] = a_re[l] + b_re[l];
+				d_im[l] = a_im[l] + b_im[l];
+			}
+			break;
+		case function_expr_sub:
+			for (size_t l = 0; l < len; ++l) {
+				d_re[l] = a_re[l] - b_re[l];
+				d_im[l] = a_im[l] - b_im[l];
+			}
+			break;
+		case function_expr_mul:
+			for (size_t l = 0; l < len; ++l) {
+				double ar = a_re[l];
+				double ai = a_im[l];
+				double br = b_re[l];
+				double bi = b_im[l];
+				d_re[l] = (ar * br) - (ai * bi);
+				d_im[l] = (ar * bi) + (ai * br);
+			}
+			break;
+		case function_expr_div:
+			for (size_t l = 0; l < len; ++l) {
+				double ar = a_re[l];
+				double ai = a_im[l];
+				double br = b_re[l];
+				double bi = b_im[l];
+				double den = (br * br) + (bi * bi);
+				d_re[l] = ((ar * br) + (ai * bi)) / den;
+				d_im[l] = ((ai * br) - (ar * bi)) / den;
+			}
+			break;
+		case function_expr_neg:
+			for (size_t l = 0; l < len; ++l) {
+				d_re[l] = -a_re[l];
+				d_im[l] = -a_im[l];
+			}
+			break;
+		case function_expr_conj:
+			for (size_t l = 0; l < len; ++l) {
+				d_re[l] = a_re[l];
+				d_im[l] = -a_im[l];
+			}
+			break;
+		case function_expr_abs:
+			for (size_t l = 0; l < len; ++l) {
+				d_re[l] = fabs(a_re[l]);
+				d_im[l] = fabs(a_im[l]);
+			}
+			break;
+		}
+	}
+}
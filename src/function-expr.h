@@ -0,0 +1,64 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* function-expr.h: iteration functions from a formula, as bytecode */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#ifndef FUNCTION_EXPR_H
+#define FUNCTION_EXPR_H 1
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ A formula such as "z^3 + c*z + seed" is compiled once into a short
+ program for a register machine. Each register holds a complex number
+ for every lane of a block, as separate arrays of real and imaginary
+ parts, and each instruction is one loop over the lanes: the cost of
+ decoding an instruction is paid once per block rather than per point,
+ and the loops are plain enough for the compiler to vectorize.
+
+ The formula may use z, c (the location of the point), seed, i, real
+ numbers such as 2.5 or imaginary ones such as 0.5i, the operators
+ + - * / and unary -, ^ with a whole number exponent (unrolled at
+ compile time into multiplies), parentheses, conj(w) and abs(w), which
+ takes the absolute value of each part, as the burning ship does.
+
+ Lanes are double precision, unlike the long double of the pfuncs[]
+ kernels, so a formula will not zoom as deep as a built-in function.
+*/
+#define function_expr_lanes 64
+#define function_expr_registers 32
+
+/* loaded by the caller before each run of steps; z is the result */
+#define function_expr_reg_z 0
+#define function_expr_reg_c 1
+#define function_expr_reg_seed 2
+
+struct function_expr;
+typedef struct function_expr function_expr_s;
+
+typedef struct function_expr_vm {
+	/* lanes in use, at most function_expr_lanes */
+	size_t len;
+	double re[function_expr_registers][function_expr_lanes];
+	double im[function_expr_registers][function_expr_lanes];
+} function_expr_vm_s;
+
+/* returns NULL on error, with a message in err */
+function_expr_s *function_expr_compile(const char *source, char *err,
+				       size_t err_len);
+
+void function_expr_free(function_expr_s *expr);
+
+const char *function_expr_source(const function_expr_s *expr);
+
+/* instructions run per step, for reporting */
+size_t function_expr_length(const function_expr_s *expr);
+
+/* fills the constant registers; call once z, c and seed are loaded */
+void function_expr_load(const function_expr_s *expr, function_expr_vm_s *vm);
+
+/* one step of every lane: z = f(z, c, seed) */
+void function_expr_step(const function_expr_s *expr, function_expr_vm_s *vm);
+
+#endif /* FUNCTION_EXPR_H */
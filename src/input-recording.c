@@ -0,0 +1,116 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* input-recording.c: human_input_s per frame, to a file and back */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#include <ctype.h>
+#include <inttypes.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <logerr-die.h>
+#include <coord-plane-option-parser.h>
+#include <input-recording.h>
+
+#define human_input_recording_version 1
+
+/* the order of the bits in a line; append, never reorder */
+static const size_t human_input_keys[] = {
+	offsetof(human_input_s, up),
+	offsetof(human_input_s, w),
+	offsetof(human_input_s, left),
+	offsetof(human_input_s, a),
+	offsetof(human_input_s, down),
+	offsetof(human_input_s, s),
+	offsetof(human_input_s, right),
+	offsetof(human_input_s, d),
+	offsetof(human_input_s, page_up),
+	offsetof(human_input_s, z),
+	offsetof(human_input_s, page_down),
+	offsetof(human_input_s, x),
+	offsetof(human_input_s, m),
+	offsetof(human_input_s, n),
+	offsetof(human_input_s, h),
+	offsetof(human_input_s, q),
+	offsetof(human_input_s, space),
+	offsetof(human_input_s, esc),
+};
+
+static const size_t human_input_keys_len =
+    (sizeof(human_input_keys) / sizeof(human_input_keys[0]));
+
+static keyboard_key_s *human_input_key(human_input_s *input, size_t i)
+{
+	return (keyboard_key_s *)(((char *)input) + human_input_keys[i]);
+}
+
+/* two bits per key: is_down, then was_down */
+static uint64_t human_input_keys_pack(const human_input_s *input)
+{
+	human_input_s copy = *input;
+	uint64_t bits = 0;
+	for (size_t i = 0; i < human_input_keys_len; ++i) {
+		keyboard_key_s *key = human_input_key(&copy, i);
+		bits |= ((uint64_t)key->is_down) << (2 * i);
+		bits |= ((uint64_t)key->was_down) << ((2 * i) + 1);
+	}
+	return bits;
+}
+
+static void human_input_keys_unpack(human_input_s *input, uint64_t bits)
+{
+	for (size_t i = 0; i < human_input_keys_len; ++i) {
+		keyboard_key_s *key = human_input_key(input, i);
+		key->is_down = (bits >> (2 * i)) & 1;
+		key->was_down = (bits >> ((2 * i) + 1)) & 1;
+	}
+}
+
+void human_input_recording_header(FILE *out, coordinate_plane_s *plane)
+{
+	fprintf(out, "# input recording v%d, replay with these options:\n",
+		human_input_recording_version);
+	print_command_line(plane, out);
+	fprintf(out, "# nsec width height it_per_frame keys click click_x"
+		" click_y wheel_zoom\n");
+}
+
+int human_input_frame_write(FILE *out, const human_input_frame_s *frame)
+{
+	const human_input_s *input = &frame->input;
+	int written = fprintf(out, "%" PRIu64 " %" PRIu32 " %" PRIu32 " %"
+			      PRIu32 " %" PRIx64 " %u %" PRIu32 " %" PRIu32
+			      " %d\n", frame->nsec, frame->width,
+			      frame->height, frame->it_per_frame,
+			      human_input_keys_pack(input),
+			      (unsigned)input->click, input->click_x,
+			      input->click_y, input->wheel_zoom);
+	return (written < 0) ? 1 : 0;
+}
+
+int human_input_frame_read(FILE *in, human_input_frame_s *frame)
+{
+	char line[256];
+	do {
+		if (!fgets(line, sizeof(line), in)) {
+			return 0;
+		}
+	} while (!isdigit((unsigned char)line[0]));
+
+	uint64_t keys = 0;
+	unsigned click = 0;
+	human_input_init(&frame->input);
+	int matched = sscanf(line, "%" SCNu64 " %" SCNu32 " %" SCNu32 " %"
+			     SCNu32 " %" SCNx64 " %u %" SCNu32 " %" SCNu32
+			     " %d", &frame->nsec, &frame->width,
+			     &frame->height, &frame->it_per_frame, &keys,
+			     &click, &frame->input.click_x,
+			     &frame->input.click_y,
+			     &frame->input.wheel_zoom);
+	if (matched != 9) {
+		logerror("malformed input recording line: '%s'", line);
+		return -1;
+	}
+	human_input_keys_unpack(&frame->input, keys);
+	frame->input.click = click;
+	return 1;
+}
@@ -0,0 +1,39 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* input-recording.h: human_input_s per frame, to a file and back */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#ifndef INPUT_RECORDING_H
+#define INPUT_RECORDING_H 1
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include <pixel-coord-plane-iteration.h>
+
+/*
+ A text file, one line per frame. With the same starting options, the
+ plane is a function of the input, the window size and the iterations
+ of each frame, so those are what is recorded; the time is kept so that
+ a replay can be paced as it was recorded, or run flat out.
+ Lines which do not start with a digit are comments; those at the top
+ hold the command line of the recorded session, to replay it with.
+*/
+typedef struct human_input_frame {
+	/* since the first frame */
+	uint64_t nsec;
+	uint32_t width;
+	uint32_t height;
+	uint32_t it_per_frame;
+	human_input_s input;
+} human_input_frame_s;
+
+/* the comment line(s) which start a recording */
+void human_input_recording_header(FILE *out, coordinate_plane_s *plane);
+
+/* returns 0 on success */
+int human_input_frame_write(FILE *out, const human_input_frame_s *frame);
+
+/* returns 1 if a frame was read, 0 at the end, -1 on a malformed line */
+int human_input_frame_read(FILE *in, human_input_frame_s *frame);
+
+#endif /* INPUT_RECORDING_H */
@@ -1,18 +1,360 @@
 /* SPDX-License-Identifier: LGPL-3.0-or-later */
-/* logerr-die.c: _global_err_stream */
+/* logerr-die.c: logerr_printf, its async rings, alloc_or_die counts */
 /* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
 
 #include <execinfo.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef SKIP_THREADS
+#include <threads.h>
+#endif
 
 #include <logerr-die.h>
+#include <alloc-or-die.h>
 
 FILE *_global_err_stream = NULL;
 
+#define logerr_ring_len 128
+#define logerr_message_len 256
+
+/* avoid POSIX undefined stdout+stderr */
+/* https://pubs.opengroup.org/onlinepubs/9699919799/functions/V2_chap02.html#tag_15_05_01 */
+static void logerr_write(const char *message)
+{
+	fflush(stdout);
+	fputs(message, _err_stream);
+	fflush(_err_stream);
+}
+
+static void logerr_vformat(char *buf, size_t len, const char *file, int line,
+			   const char *format, va_list args)
+{
+	int used = snprintf(buf, len, "%s:%d: ", file, line);
+	if (used < 0 || (size_t)used >= len) {
+		used = 0;
+	}
+	vsnprintf(buf + used, len - used, format, args);
+	size_t end = strlen(buf);
+	if (end == (len - 1)) {
+		--end;
+	}
+	buf[end] = '\n';
+	buf[end + 1] = '\0';
+}
+
+void logerr_printf_sync(const char *file, int line, const char *format, ...)
+{
+	logerr_flush();
+	char buf[logerr_message_len];
+	va_list args;
+	va_start(args, format);
+	logerr_vformat(buf, sizeof(buf), file, line, format, args);
+	va_end(args);
+	logerr_write(buf);
+}
+
+#ifdef SKIP_THREADS
+
+int logerr_async_start(void)
+{
+	return 0;
+}
+
+void logerr_flush(void)
+{
+}
+
+static void logerr_flush_crash(void)
+{
+}
+
+void logerr_printf(const char *file, int line, const char *format, ...)
+{
+	char buf[logerr_message_len];
+	va_list args;
+	va_start(args, format);
+	logerr_vformat(buf, sizeof(buf), file, line, format, args);
+	va_end(args);
+	logerr_write(buf);
+}
+
+#else
+
+typedef struct logerr_ring {
+	struct logerr_ring *next;
+	/* claimed by a live thread; released when it exits */
+	atomic_bool in_use;
+	/* only the owning thread stores head, only the drain stores tail */
+	atomic_uint_fast64_t head;
+	atomic_uint_fast64_t tail;
+	atomic_uint_fast64_t dropped;
+	/* the owning thread's rate limit window */
+	uint64_t window_nsec;
+	uint32_t window_count;
+	char messages[logerr_ring_len][logerr_message_len];
+} logerr_ring_s;
+
+static atomic_bool logerr_async = false;
+static atomic_bool logerr_stop = false;
+static atomic_flag logerr_draining = ATOMIC_FLAG_INIT;
+static _Atomic(logerr_ring_s *) logerr_rings = NULL;
+static _Thread_local logerr_ring_s *logerr_ring = NULL;
+static tss_t logerr_ring_key;
+static thrd_t logerr_drain_thread;
+
+static uint64_t logerr_time_in_nsec(void)
+{
+	struct timespec ts = { 0, 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t nsec_per_sec = (1000 * 1000 * 1000);
+	return (nsec_per_sec * ts.tv_sec) + ts.tv_nsec;
+}
+
+/* the tss destructor: a ring outlives its thread, for the next one */
+static void logerr_ring_release(void *arg)
+{
+	logerr_ring_s *ring = arg;
+	atomic_store(&ring->in_use, false);
+}
+
+/* the first message of a thread claims a released ring or links a new
+   one; not malloc_or_log, as that would log */
+static logerr_ring_s *logerr_thread_ring(void)
+{
+	if (logerr_ring) {
+		return logerr_ring;
+	}
+	logerr_ring_s *ring = NULL;
+	for (ring = atomic_load(&logerr_rings); ring; ring = ring->next) {
+		bool expected = false;
+		if (atomic_compare_exchange_strong(&ring->in_use, &expected,
+						   true)) {
+			break;
+		}
+	}
+	if (!ring) {
+		ring = malloc(sizeof(logerr_ring_s));
+		if (!ring) {
+			return NULL;
+		}
+		atomic_init(&ring->in_use, true);
+		atomic_init(&ring->head, 0);
+		atomic_init(&ring->tail, 0);
+		atomic_init(&ring->dropped, 0);
+		ring->next = atomic_load(&logerr_rings);
+		while (!atomic_compare_exchange_weak(&logerr_rings,
+						     &ring->next, ring)) {
+			/* ring->next now holds the current list head */
+		}
+	}
+	ring->window_nsec = 0;
+	ring->window_count = 0;
+	tss_set(logerr_ring_key, ring);
+	logerr_ring = ring;
+	return ring;
+}
+
+/* one drainer at a time; returns the number of messages written */
+static size_t logerr_drain(void)
+{
+	size_t written = 0;
+	for (logerr_ring_s *ring = atomic_load(&logerr_rings); ring;
+	     ring = ring->next) {
+		uint_fast64_t head =
+		    atomic_load_explicit(&ring->head, memory_order_acquire);
+		uint_fast64_t tail =
+		    atomic_load_explicit(&ring->tail, memory_order_relaxed);
+		for (; tail < head; ++tail) {
+			logerr_write(ring->messages[tail % logerr_ring_len]);
+			++written;
+		}
+		atomic_store_explicit(&ring->tail, tail, memory_order_release);
+		uint_fast64_t dropped = atomic_exchange(&ring->dropped, 0);
+		if (dropped) {
+			char buf[logerr_message_len];
+			snprintf(buf, sizeof(buf), "%s:%d: %" PRIuFAST64
+				 " messages dropped\n", __FILE__, __LINE__,
+				 dropped);
+			logerr_write(buf);
+		}
+	}
+	return written;
+}
+
+static int logerr_drain_loop(void *arg)
+{
+	(void)arg;
+	struct timespec idle = { 0, 10 * 1000 * 1000 };
+	while (!atomic_load(&logerr_stop)) {
+		if (!atomic_flag_test_and_set(&logerr_draining)) {
+			logerr_drain();
+			atomic_flag_clear(&logerr_draining);
+		}
+		thrd_sleep(&idle, NULL);
+	}
+	return 0;
+}
+
+/* the drain thread may hold the flag for as long as a slow write to a
+   full pipe takes, so wait for it: two drainers would write twice */
+static void logerr_drain_when_free(void)
+{
+	struct timespec pause = { 0, 1000 * 1000 };
+	while (atomic_flag_test_and_set(&logerr_draining)) {
+		thrd_sleep(&pause, NULL);
+	}
+	logerr_drain();
+	atomic_flag_clear(&logerr_draining);
+}
+
+void logerr_flush(void)
+{
+	if (!atomic_load(&logerr_async)) {
+		return;
+	}
+	logerr_drain_when_free();
+}
+
+/* a crash may have stopped the drain thread while it held the flag, so
+   wait only briefly for it before draining regardless */
+static void logerr_flush_crash(void)
+{
+	if (!atomic_load(&logerr_async)) {
+		return;
+	}
+	struct timespec pause = { 0, 1000 * 1000 };
+	for (size_t i = 0; i < 100; ++i) {
+		if (!atomic_flag_test_and_set(&logerr_draining)) {
+			logerr_drain();
+			atomic_flag_clear(&logerr_draining);
+			return;
+		}
+		thrd_sleep(&pause, NULL);
+	}
+	logerr_drain();
+}
+
+/* from here on logerror writes at once, as do other exit handlers and
+   workers still running; then the rings are drained one last time */
+static void logerr_stop_at_exit(void)
+{
+	atomic_store(&logerr_async, false);
+	atomic_store(&logerr_stop, true);
+	thrd_join(logerr_drain_thread, NULL);
+	logerr_drain_when_free();
+}
+
+int logerr_async_start(void)
+{
+	if (atomic_load(&logerr_async)) {
+		return 0;
+	}
+	if (tss_create(&logerr_ring_key, logerr_ring_release) != thrd_success) {
+		logerror("%s", "tss_create(&logerr_ring_key) failed");
+		return 1;
+	}
+	if (thrd_create(&logerr_drain_thread, logerr_drain_loop, NULL)
+	    != thrd_success) {
+		logerror("%s", "thrd_create(logerr_drain_loop) failed");
+		return 1;
+	}
+	if (atexit(logerr_stop_at_exit)) {
+		atomic_store(&logerr_stop, true);
+		thrd_join(logerr_drain_thread, NULL);
+		logerror("%s", "atexit(logerr_stop_at_exit) failed");
+		return 1;
+	}
+	atomic_store(&logerr_async, true);
+	return 0;
+}
+
+/* within the rate, and with room in the ring, else counted as dropped */
+static bool logerr_admit(logerr_ring_s *ring)
+{
+	uint64_t nsec_per_sec = (1000 * 1000 * 1000);
+	uint64_t now = logerr_time_in_nsec();
+	if (now - ring->window_nsec >= nsec_per_sec) {
+		ring->window_nsec = now;
+		ring->window_count = 0;
+	}
+	uint_fast64_t head =
+	    atomic_load_explicit(&ring->head, memory_order_relaxed);
+	uint_fast64_t tail =
+	    atomic_load_explicit(&ring->tail, memory_order_acquire);
+	if ((ring->window_count >= logerr_rate_per_sec)
+	    || ((head - tail) >= logerr_ring_len)) {
+		atomic_fetch_add_explicit(&ring->dropped, 1,
+					  memory_order_relaxed);
+		return false;
+	}
+	++(ring->window_count);
+	return true;
+}
+
+void logerr_printf(const char *file, int line, const char *format, ...)
+{
+	logerr_ring_s *ring = NULL;
+	if (atomic_load_explicit(&logerr_async, memory_order_relaxed)) {
+		ring = logerr_thread_ring();
+	}
+	va_list args;
+	va_start(args, format);
+	if (!ring) {
+		char buf[logerr_message_len];
+		logerr_vformat(buf, sizeof(buf), file, line, format, args);
+		logerr_write(buf);
+	} else if (logerr_admit(ring)) {
+		uint_fast64_t head =
+		    atomic_load_explicit(&ring->head, memory_order_relaxed);
+		char *buf = ring->messages[head % logerr_ring_len];
+		logerr_vformat(buf, logerr_message_len, file, line, format,
+			       args);
+		atomic_store_explicit(&ring->head, head + 1,
+				      memory_order_release);
+	}
+	va_end(args);
+}
+
+#endif /* SKIP_THREADS */
+
+#ifdef ALLOC_OR_DIE_COUNTING
+static atomic_uint_fast64_t alloc_or_die_allocations = 0;
+static atomic_uint_fast64_t alloc_or_die_bytes = 0;
+
+void alloc_or_die_count_bytes(size_t size)
+{
+	atomic_fetch_add_explicit(&alloc_or_die_allocations, 1,
+				  memory_order_relaxed);
+	atomic_fetch_add_explicit(&alloc_or_die_bytes, size,
+				  memory_order_relaxed);
+}
+#endif
+
+int alloc_or_die_counts(uint64_t *allocations, uint64_t *bytes)
+{
+#ifdef ALLOC_OR_DIE_COUNTING
+	*allocations = atomic_load(&alloc_or_die_allocations);
+	*bytes = atomic_load(&alloc_or_die_bytes);
+	return 1;
+#else
+	*allocations = 0;
+	*bytes = 0;
+	return 0;
+#endif
+}
+
 void backtrace_exit_handler(int sig)
 {
 	void *array[100];
 	size_t size;
 
+	logerr_flush_crash();
 	size = backtrace(array, 100);
 
 	fprintf(_err_stream, "Error: signal %d:\n", sig);
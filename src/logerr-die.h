@@ -14,23 +14,51 @@ extern FILE *_global_err_stream;
 #define _err_stream (_global_err_stream ? _global_err_stream : stderr)
 #endif
 
+/*
+ Opt-in. Until logerr_async_start is called, logerror writes to the err
+ stream at once, as it always has. After, each thread formats into a
+ ring of its own, which it alone writes, so logging takes no locks; a
+ drain thread writes the rings out. A thread logging more than
+ logerr_rate_per_sec messages in a second, or faster than the drain
+ keeps up, has the excess dropped and counted. die writes at once,
+ after flushing what is pending, as does the backtrace_exit_handler.
+ At exit logging returns to synchronous, so that messages from workers
+ still running are not lost, and the rings are drained a last time.
+ Built with -DSKIP_THREADS, logerror is always synchronous.
+*/
+#ifndef logerr_rate_per_sec
+#define logerr_rate_per_sec 100
+#endif
+
+/* returns 0 on success */
+int logerr_async_start(void);
+
+/* writes out what every ring holds, waiting for the drain thread if it
+   is writing; safe to call at any time but from the drain itself */
+void logerr_flush(void);
+
+void logerr_printf(const char *file, int line, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
+/* flushes, then writes at once: for messages which must not be lost */
+void logerr_printf_sync(const char *file, int line, const char *format, ...)
+#ifdef __GNUC__
+    __attribute__((format(printf, 3, 4)))
+#endif
+    ;
+
 #ifndef logerror
 #define logerror(format, ...) \
-	do { \
-		fflush(stdout); /* avoid POSIX undefined stdout+stderr */ \
-		/* https://pubs.opengroup.org/onlinepubs/9699919799/functions/V2_chap02.html#tag_15_05_01 */ \
-		fprintf(_err_stream, "%s:%d: ", __FILE__, __LINE__); \
-		/* fprintf(_err_stream, format __VA_OPT__(,) __VA_ARGS__); */ \
-		/* fprintf(_err_stream, format, ##_VA_ARGS__); */ \
-		fprintf(_err_stream, format, __VA_ARGS__); \
-		fprintf(_err_stream, "\n"); \
-	} while (0)
+	logerr_printf(__FILE__, __LINE__, format, __VA_ARGS__)
 #endif
 
 #ifndef die
 #define die(format, ...) \
 	do { \
-		logerror(format, __VA_ARGS__); \
+		logerr_printf_sync(__FILE__, __LINE__, format, __VA_ARGS__); \
 		exit(EXIT_FAILURE); \
 	} while (0)
 #endif
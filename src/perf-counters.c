@@ -0,0 +1,403 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* perf-counters.c: per-thread perf_event_open counters by phase */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifndef SKIP_THREADS
+#include <threads.h>
+#endif
+
+#include <logerr-die.h>
+#include <alloc-or-die.h>
+#include <perf-counters.h>
+
+#ifdef __linux__
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static const char *perf_counters_phase_names[perf_counters_phase_len] = {
+	"reset",
+	"iterate",
+	"merge",
+	"colourize"
+};
+
+/* the order of the counters in a group, whichever of them open */
+enum perf_counters_event {
+	perf_counters_cycles,
+	perf_counters_instructions,
+	perf_counters_cache_misses,
+	perf_counters_dtlb_misses,
+	perf_counters_branch_misses,
+	perf_counters_task_clock,
+	perf_counters_page_faults,
+	perf_counters_event_len
+};
+
+static const char *perf_counters_event_names[perf_counters_event_len] = {
+	"cycles",
+	"instructions",
+	"cache-misses",
+	"dTLB-load-misses",
+	"branch-misses",
+	"task-clock-ns",
+	"page-faults"
+};
+
+/* claimed by a live thread; when it exits its counters are closed, and
+   the totals kept, for the summary and for the next thread to add to */
+typedef struct perf_counters_thread {
+	struct perf_counters_thread *next;
+	atomic_bool in_use;
+	int fds[perf_counters_event_len];
+	/* slot in the group read of each event, or -1 if not opened */
+	int slot[perf_counters_event_len];
+	size_t opened;
+	/* over every thread which has held this, for the summary */
+	size_t threads;
+	bool counted[perf_counters_event_len];
+	uint64_t begin[perf_counters_event_len];
+	uint64_t totals[perf_counters_phase_len][perf_counters_event_len];
+	uint64_t calls[perf_counters_phase_len];
+} perf_counters_thread_s;
+
+static atomic_bool perf_counters_enabled = false;
+static _Atomic(perf_counters_thread_s *) perf_counters_threads = NULL;
+static _Thread_local perf_counters_thread_s *perf_counters_thread = NULL;
+static atomic_bool perf_counters_warned = false;
+#if defined(__linux__) && !defined(SKIP_THREADS)
+static tss_t perf_counters_key;
+#endif
+
+#ifdef __linux__
+static void perf_counters_attr(struct perf_event_attr *attr,
+			       enum perf_counters_event event)
+{
+	memset(attr, 0x00, sizeof(struct perf_event_attr));
+	attr->size = sizeof(struct perf_event_attr);
+	attr->exclude_kernel = 1;
+	attr->exclude_hv = 1;
+	attr->read_format = PERF_FORMAT_GROUP
+	    | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+	attr->type = PERF_TYPE_HARDWARE;
+	switch (event) {
+	case perf_counters_cycles:
+		attr->config = PERF_COUNT_HW_CPU_CYCLES;
+		break;
+	case perf_counters_instructions:
+		attr->config = PERF_COUNT_HW_INSTRUCTIONS;
+		break;
+	case perf_counters_cache_misses:
+		attr->config = PERF_COUNT_HW_CACHE_MISSES;
+		break;
+	case perf_counters_dtlb_misses:
+		attr->type = PERF_TYPE_HW_CACHE;
+		attr->config = PERF_COUNT_HW_CACHE_DTLB
+		    | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+		    | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+		break;
+	case perf_counters_branch_misses:
+		attr->config = PERF_COUNT_HW_BRANCH_MISSES;
+		break;
+	case perf_counters_task_clock:
+		attr->type = PERF_TYPE_SOFTWARE;
+		attr->config = PERF_COUNT_SW_TASK_CLOCK;
+		break;
+	case perf_counters_page_faults:
+		attr->type = PERF_TYPE_SOFTWARE;
+		attr->config = PERF_COUNT_SW_PAGE_FAULTS;
+		break;
+	case perf_counters_event_len:
+		break;
+	}
+}
+
+static void perf_counters_open_group(perf_counters_thread_s *thread)
+{
+	int leader = -1;
+	for (size_t i = 0; i < perf_counters_event_len; ++i) {
+		struct perf_event_attr attr;
+		perf_counters_attr(&attr, i);
+		pid_t self = 0;
+		int any_cpu = -1;
+		unsigned long flags = 0;
+		int fd = syscall(SYS_perf_event_open, &attr, self, any_cpu,
+				 leader, flags);
+		if (fd < 0) {
+			if (!atomic_exchange(&perf_counters_warned, true)) {
+				logerror("perf_event_open(%s): %s (is there"
+					 " a PMU? perf_event_paranoid?),"
+					 " counting what opens",
+					 perf_counters_event_names[i],
+					 strerror(errno));
+			}
+			continue;
+		}
+		if (leader < 0) {
+			leader = fd;
+		}
+		thread->fds[i] = fd;
+		thread->slot[i] = thread->opened++;
+		thread->counted[i] = true;
+	}
+	if (leader >= 0) {
+		ioctl(leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+		ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+	}
+}
+
+/* scaled for any time the group was multiplexed off of the PMU */
+static int perf_counters_read(perf_counters_thread_s *thread, uint64_t *out)
+{
+	uint64_t buf[3 + perf_counters_event_len];
+	int leader = -1;
+	for (size_t i = 0; i < perf_counters_event_len && leader < 0; ++i) {
+		if (thread->slot[i] == 0) {
+			leader = thread->fds[i];
+		}
+	}
+	ssize_t want = sizeof(uint64_t) * (3 + thread->opened);
+	if (leader < 0 || read(leader, buf, sizeof(buf)) < want) {
+		return 1;
+	}
+	uint64_t enabled = buf[1];
+	uint64_t running = buf[2];
+	for (size_t i = 0; i < perf_counters_event_len; ++i) {
+		if (thread->slot[i] < 0) {
+			out[i] = 0;
+			continue;
+		}
+		uint64_t value = buf[3 + thread->slot[i]];
+		if (running && running < enabled) {
+			value = (uint64_t)((1.0 * value * enabled) / running);
+		}
+		out[i] = value;
+	}
+	return 0;
+}
+
+#ifndef SKIP_THREADS
+static void perf_counters_close_group(perf_counters_thread_s *thread)
+{
+	for (size_t i = 0; i < perf_counters_event_len; ++i) {
+		if (thread->fds[i] >= 0) {
+			close(thread->fds[i]);
+		}
+		thread->fds[i] = -1;
+		thread->slot[i] = -1;
+	}
+	thread->opened = 0;
+}
+
+/* the tss destructor: without it each pool rebuild would leak a group
+   of file descriptors per worker */
+static void perf_counters_thread_release(void *arg)
+{
+	perf_counters_thread_s *thread = arg;
+	perf_counters_close_group(thread);
+	atomic_store(&thread->in_use, false);
+}
+#endif
+#endif /* __linux__ */
+
+#ifdef __linux__
+static void perf_counters_summary_at_exit(void)
+{
+	perf_counters_summary(stderr);
+}
+#endif
+
+int perf_counters_start(void)
+{
+#ifdef __linux__
+	if (atomic_load(&perf_counters_enabled)) {
+		return 0;
+	}
+#ifndef SKIP_THREADS
+	if (tss_create(&perf_counters_key, perf_counters_thread_release)
+	    != thrd_success) {
+		logerror("%s", "tss_create(&perf_counters_key) failed");
+		return 1;
+	}
+#endif
+	atomic_store(&perf_counters_enabled, true);
+	if (atexit(perf_counters_summary_at_exit)) {
+		logerror("%s", "atexit(perf_counters_summary_at_exit) failed");
+	}
+	return 0;
+#else
+	logerror("%s", "perf counters need perf_event_open (Linux)");
+	return 1;
+#endif
+}
+
+static perf_counters_thread_s *perf_counters_this_thread(void)
+{
+	if (perf_counters_thread) {
+		return perf_counters_thread->opened ? perf_counters_thread
+		    : NULL;
+	}
+	perf_counters_thread_s *thread = NULL;
+	for (thread = atomic_load(&perf_counters_threads); thread;
+	     thread = thread->next) {
+		bool expected = false;
+		if (atomic_compare_exchange_strong(&thread->in_use, &expected,
+						   true)) {
+			break;
+		}
+	}
+	if (!thread) {
+		malloc_or_log(&thread, sizeof(perf_counters_thread_s));
+		if (!thread) {
+			return NULL;
+		}
+		memset(thread, 0x00, sizeof(perf_counters_thread_s));
+		atomic_init(&thread->in_use, true);
+		for (size_t i = 0; i < perf_counters_event_len; ++i) {
+			thread->fds[i] = -1;
+			thread->slot[i] = -1;
+		}
+		thread->next = atomic_load(&perf_counters_threads);
+		while (!atomic_compare_exchange_weak(&perf_counters_threads,
+						     &thread->next, thread)) {
+			/* thread->next now holds the current list head */
+		}
+	}
+#ifdef __linux__
+	perf_counters_open_group(thread);
+#endif
+	if (thread->opened) {
+		++(thread->threads);
+	}
+#if defined(__linux__) && !defined(SKIP_THREADS)
+	tss_set(perf_counters_key, thread);
+#endif
+	perf_counters_thread = thread;
+	return thread->opened ? thread : NULL;
+}
+
+void perf_counters_begin(enum perf_counters_phase phase)
+{
+	(void)phase;
+	if (!atomic_load_explicit(&perf_counters_enabled,
+				  memory_order_relaxed)) {
+		return;
+	}
+#ifdef __linux__
+	perf_counters_thread_s *thread = perf_counters_this_thread();
+	if (thread) {
+		perf_counters_read(thread, thread->begin);
+	}
+#endif
+}
+
+void perf_counters_end(enum perf_counters_phase phase)
+{
+	if (!atomic_load_explicit(&perf_counters_enabled,
+				  memory_order_relaxed)) {
+		return;
+	}
+#ifdef __linux__
+	perf_counters_thread_s *thread = perf_counters_this_thread();
+	uint64_t end[perf_counters_event_len];
+	if (!thread || perf_counters_read(thread, end)) {
+		return;
+	}
+	for (size_t i = 0; i < perf_counters_event_len; ++i) {
+		if (end[i] > thread->begin[i]) {
+			thread->totals[phase][i] += end[i] - thread->begin[i];
+		}
+	}
+	++(thread->calls[phase]);
+#else
+	(void)phase;
+#endif
+}
+
+static double perf_counters_per_k(uint64_t count, uint64_t instructions)
+{
+	return instructions ? ((1000.0 * count) / instructions) : 0.0;
+}
+
+void perf_counters_summary(FILE *out)
+{
+	uint64_t totals[perf_counters_phase_len][perf_counters_event_len];
+	uint64_t calls[perf_counters_phase_len];
+	memset(totals, 0x00, sizeof(totals));
+	memset(calls, 0x00, sizeof(calls));
+	bool opened[perf_counters_event_len];
+	memset(opened, 0x00, sizeof(opened));
+	size_t threads = 0;
+
+	for (perf_counters_thread_s *t = atomic_load(&perf_counters_threads);
+	     t; t = t->next) {
+		if (!t->threads) {
+			continue;
+		}
+		threads += t->threads;
+		for (size_t p = 0; p < perf_counters_phase_len; ++p) {
+			calls[p] += t->calls[p];
+			for (size_t e = 0; e < perf_counters_event_len; ++e) {
+				totals[p][e] += t->totals[p][e];
+				opened[e] = opened[e] || t->counted[e];
+			}
+		}
+	}
+	if (!threads) {
+		fprintf(out, "perf counters: none could be opened\n");
+		return;
+	}
+
+	fprintf(out, "perf counters over %zu threads:\n", threads);
+	for (size_t p = 0; p < perf_counters_phase_len; ++p) {
+		if (!calls[p]) {
+			continue;
+		}
+		uint64_t *t = totals[p];
+		fprintf(out, "%-10s calls: %" PRIu64, perf_counters_phase_names[p],
+			calls[p]);
+		for (size_t e = 0; e < perf_counters_event_len; ++e) {
+			if (opened[e]) {
+				fprintf(out, " %s: %" PRIu64,
+					perf_counters_event_names[e], t[e]);
+			}
+		}
+		uint64_t instructions = t[perf_counters_instructions];
+		if (opened[perf_counters_instructions] && instructions) {
+			if (opened[perf_counters_cycles]) {
+				fprintf(out, " IPC: %.2f", t[perf_counters_cycles]
+					? ((1.0 * instructions) /
+					   t[perf_counters_cycles]) : 0.0);
+			}
+			fprintf(out, " per 1k instructions:");
+			if (opened[perf_counters_cache_misses]) {
+				fprintf(out, " cache-miss: %.3f",
+					perf_counters_per_k(t
+							    [perf_counters_cache_misses],
+							    instructions));
+			}
+			if (opened[perf_counters_dtlb_misses]) {
+				fprintf(out, " dTLB-miss: %.3f",
+					perf_counters_per_k(t
+							    [perf_counters_dtlb_misses],
+							    instructions));
+			}
+			if (opened[perf_counters_branch_misses]) {
+				fprintf(out, " branch-miss: %.3f",
+					perf_counters_per_k(t
+							    [perf_counters_branch_misses],
+							    instructions));
+			}
+		}
+		fprintf(out, "\n");
+	}
+}
@@ -0,0 +1,37 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* perf-counters.h: per-thread perf_event_open counters by phase */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#ifndef PERF_COUNTERS_H
+#define PERF_COUNTERS_H 1
+
+#include <stdio.h>
+
+/*
+ Opt-in, and Linux only. After perf_counters_start each thread which
+ brackets a phase with perf_counters_begin and perf_counters_end opens,
+ on first use, its own group of counters for itself; the difference
+ across the phase is added to that thread's totals for the phase.
+ Counters the kernel refuses (perf_event_paranoid, a VM without a PMU)
+ are left out, and noted once; if none can be opened the calls do
+ nothing. Elsewhere every call does nothing.
+*/
+enum perf_counters_phase {
+	perf_counters_phase_reset,
+	perf_counters_phase_iterate,
+	perf_counters_phase_merge,
+	perf_counters_phase_colourize,
+	perf_counters_phase_len
+};
+
+/* returns 0 if counting will be attempted */
+int perf_counters_start(void);
+
+void perf_counters_begin(enum perf_counters_phase phase);
+
+void perf_counters_end(enum perf_counters_phase phase);
+
+/* totals over all threads; also printed to stderr at exit once started */
+void perf_counters_summary(FILE *out);
+
+#endif /* PERF_COUNTERS_H */
@@ -7,6 +7,7 @@
 #include <stdlib.h>
 #include <math.h>
 #include <inttypes.h>
+#include <string.h>
 
 #include <rgb-hsv.h>
 #include <alloc-or-die.h>
@@ -34,6 +35,42 @@ static void long_tail_gradiant(rgb24_s *result, uint32_t distance)
 	rgb24_from_rgb(result, rgb);
 }
 
+/* a hue per root, golden angles apart, darker the longer it took */
+static void root_gradiant(rgb24_s *result, uint32_t root, uint32_t steps)
+{
+	double golden_angle = 137.50776405003785;
+	double hue = fmod(golden_angle * (root - 1), 360.0);
+	double saturation = 0.85;
+	double value = 0.25 + (0.75 / (1.0 + (0.05 * steps)));
+	hsv_s hsv = { hue, saturation, value };
+	rgb_s rgb = { 0x00, 0x00, 0x00 };
+	rgb_from_hsv(&rgb, hsv);
+	rgb24_from_rgb(result, rgb);
+}
+
+static uint32_t max_cost(const uint32_t *costs, size_t len)
+{
+	uint32_t max = 0;
+	for (size_t i = 0; i < len; ++i) {
+		if (costs[i] > max) {
+			max = costs[i];
+		}
+	}
+	return max;
+}
+
+/* black, red, yellow, white on a log scale up to the costliest point */
+static void heat_gradiant(rgb24_s *result, uint32_t cost, double log_max)
+{
+	double t = (log_max > 0.0) ? (log1p(cost) / log_max) : 0.0;
+	double r = 3.0 * t;
+	double g = (3.0 * t) - 1.0;
+	double b = (3.0 * t) - 2.0;
+	result->red = 255 * ((r > 1.0) ? 1.0 : ((r < 0.0) ? 0.0 : r));
+	result->green = 255 * ((g > 1.0) ? 1.0 : ((g < 0.0) ? 0.0 : g));
+	result->blue = 255 * ((b > 1.0) ? 1.0 : ((b < 0.0) ? 0.0 : b));
+}
+
 void human_input_init(human_input_s *input)
 {
 	input->up.is_down = 0;
@@ -78,6 +115,9 @@ void human_input_init(human_input_s *input)
 	input->n.is_down = 0;
 	input->n.was_down = 0;
 
+	input->h.is_down = 0;
+	input->h.was_down = 0;
+
 	input->q.is_down = 0;
 	input->q.was_down = 0;
 
@@ -92,6 +132,29 @@ void human_input_init(human_input_s *input)
 	input->click_y = 0;
 
 	input->wheel_zoom = 0;
+
+	input->event_nsec = 0;
+	input->action = human_input_action_none;
+}
+
+const char *human_input_action_name(enum human_input_action action)
+{
+	switch (action) {
+	case human_input_action_pan:
+		return "pan";
+	case human_input_action_zoom:
+		return "zoom";
+	case human_input_action_recenter:
+		return "recenter";
+	case human_input_action_function:
+		return "function";
+	case human_input_action_other:
+		return "other";
+	case human_input_action_none:
+	case human_input_action_len:
+	default:
+		return "none";
+	}
 }
 
 enum coordinate_plane_change human_input_process(human_input_s *input,
@@ -103,8 +166,16 @@ enum coordinate_plane_change human_input_process(human_input_s *input,
 
 	if (input->space.is_down) {
 		coordinate_plane_next_function(plane);
+		input->action = human_input_action_function;
 		return coordinate_plane_change_yes;
 	}
+	if (input->h.is_down && !input->h.was_down) {
+		bool record = !coordinate_plane_recording_costs(plane);
+		coordinate_plane_record_costs(plane, record);
+		input->action = human_input_action_other;
+		return record ? coordinate_plane_change_yes :
+		    coordinate_plane_change_no;
+	}
 #ifndef SKIP_THREADS
 	if (input->m.is_down && !input->m.was_down) {
 		coordinate_plane_threads_more(plane);
@@ -119,40 +190,47 @@ enum coordinate_plane_change human_input_process(human_input_s *input,
 	if ((input->w.is_down && !input->w.was_down) ||
 	    (input->up.is_down && !input->up.was_down)) {
 		coordinate_plane_pan_up(plane);
+		input->action = human_input_action_pan;
 		return coordinate_plane_change_yes;
 	}
 	if ((input->s.is_down && !input->s.was_down) ||
 	    (input->down.is_down && !input->down.was_down)) {
 		coordinate_plane_pan_down(plane);
+		input->action = human_input_action_pan;
 		return coordinate_plane_change_yes;
 	}
 
 	if ((input->a.is_down && !input->a.was_down) ||
 	    (input->left.is_down && !input->left.was_down)) {
 		coordinate_plane_pan_left(plane);
+		input->action = human_input_action_pan;
 		return coordinate_plane_change_yes;
 	}
 	if ((input->d.is_down && !input->d.was_down) ||
 	    (input->right.is_down && !input->right.was_down)) {
 		coordinate_plane_pan_right(plane);
+		input->action = human_input_action_pan;
 		return coordinate_plane_change_yes;
 	}
 	if ((input->x.is_down && !input->x.was_down) ||
 	    (input->page_up.is_down && !input->page_up.was_down) ||
 	    (input->wheel_zoom < 0)) {
 		coordinate_plane_zoom_out(plane);
+		input->action = human_input_action_zoom;
 		return coordinate_plane_change_yes;
 	}
 	if ((input->z.is_down && !input->z.was_down) ||
 	    (input->page_down.is_down && !input->page_down.was_down) ||
 	    (input->wheel_zoom > 0)) {
 		coordinate_plane_zoom_in(plane);
+		input->action = human_input_action_zoom;
 		return coordinate_plane_change_yes;
 	}
 
 	if (input->click) {
 		coordinate_plane_recenter(plane, input->click_x,
 					  input->click_y);
+		input->action = human_input_action_recenter;
 		return coordinate_plane_change_yes;
 	}
 
@@ -168,9 +246,137 @@ void print_directions(coordinate_plane_s *plane, FILE *out)
 		"use page_down/page_up or 'z' and 'x' keys to zoom in/out\n");
 	fprintf(out, "space will cycle through available functions\n");
 	fprintf(out, "click to recenter the image\n");
+	fprintf(out, "'h' toggles the iteration cost heatmap\n");
 	fprintf(out, "escape or 'q' to quit\n");
 }
 
+static double nsec_to_msec(uint64_t nsec)
+{
+	return nsec / (1000.0 * 1000.0);
+}
+
+/* milliseconds in each phase since the stats were last cleared */
+void print_phase_times(coordinate_plane_s *plane, FILE *out)
+{
+	coordinate_plane_stats_s stats;
+	coordinate_plane_stats(plane, &stats);
+	fprintf(out, "ms reset: %.1f iterate: %.1f merge: %.1f"
+		" colourize: %.1f upload: %.1f present: %.1f",
+		nsec_to_msec(stats.reset_nsec),
+		nsec_to_msec(stats.iterate_nsec),
+		nsec_to_msec(stats.merge_nsec),
+		nsec_to_msec(stats.colourize_nsec),
+		nsec_to_msec(stats.upload_nsec),
+		nsec_to_msec(stats.present_nsec));
+	if (stats.frames) {
+		fprintf(out, " frame p50: %.1f p99: %.1f",
+			nsec_to_msec(stats.frame_p50_nsec),
+			nsec_to_msec(stats.frame_p99_nsec));
+	}
+}
+
+void input_latency_clear(input_latency_s *latency)
+{
+	memset(latency, 0x00, sizeof(input_latency_s));
+}
+
+void input_latency_add(input_latency_s *latency,
+		       enum human_input_action action, uint64_t nsec)
+{
+	if (action <= human_input_action_none
+	    || action >= human_input_action_len) {
+		return;
+	}
+	uint64_t usec = nsec / 1000;
+	size_t bucket = 0;
+	while ((usec >>= 1) && (bucket < (input_latency_buckets - 1))) {
+		++bucket;
+	}
+	++latency->counts[action][bucket];
+	++latency->total[action];
+	if (nsec > latency->max_nsec[action]) {
+		latency->max_nsec[action] = nsec;
+	}
+}
+
+/* the upper bound of the bucket holding the given fraction of samples */
+static double input_latency_percentile_msec(const uint64_t *counts,
+					    uint64_t total, double fraction)
+{
+	uint64_t want = (uint64_t)ceil(total * fraction);
+	uint64_t seen = 0;
+	for (size_t b = 0; b < input_latency_buckets; ++b) {
+		seen += counts[b];
+		if (seen >= want) {
+			return (1ULL << (b + 1)) / 1000.0;
+		}
+	}
+	return (1ULL << input_latency_buckets) / 1000.0;
+}
+
+void print_input_latency(input_latency_s *latency, FILE *out)
+{
+	fprintf(out, "input to present latency, ms (p50 and p99 are"
+		" bucket upper bounds):\n");
+	for (size_t a = human_input_action_none + 1;
+	     a < human_input_action_len; ++a) {
+		uint64_t total = latency->total[a];
+		if (!total) {
+			continue;
+		}
+		const uint64_t *counts = latency->counts[a];
+		double max_msec = nsec_to_msec(latency->max_nsec[a]);
+		fprintf(out, "%-10s n: %" PRIu64 " p50: <%.3f p99: <%.3f"
+			" max: %.3f\n", human_input_action_name(a), total,
+			fmin(input_latency_percentile_msec(counts, total, 0.50),
+			     max_msec),
+			fmin(input_latency_percentile_msec(counts, total, 0.99),
+			     max_msec), max_msec);
+		for (size_t b = 0; b < input_latency_buckets; ++b) {
+			if (counts[b]) {
+				fprintf(out, "%10s <%9.3f: %" PRIu64 "\n", "",
+					(1ULL << (b + 1)) / 1000.0, counts[b]);
+			}
+		}
+	}
+}
+
+static double bytes_to_kib(size_t bytes)
+{
+	return bytes / 1024.0;
+}
+
+void print_memory_usage(coordinate_plane_s *plane, pixel_buffer_s *buf,
+			FILE *out)
+{
+	coordinate_plane_memory_s memory;
+	coordinate_plane_memory_usage(plane, &memory);
+	fprintf(out, "KiB plane: %.1f (high: %.1f) points: %.1f"
+		" escaped: %.1f costs: %.1f scratch: %.1f not_escaped: %.1f"
+		" contexts: %.1f pool: %.1f",
+		bytes_to_kib(memory.live), bytes_to_kib(memory.high_water),
+		bytes_to_kib(memory.all_points),
+		bytes_to_kib(memory.escaped_counts),
+		bytes_to_kib(memory.point_costs),
+		bytes_to_kib(memory.scratch),
+		bytes_to_kib(memory.points_not_escaped),
+		bytes_to_kib(memory.contexts),
+		bytes_to_kib(memory.thread_pool));
+	if (buf) {
+		pixel_buffer_memory_s pixel_memory;
+		pixel_buffer_memory_usage(buf, &pixel_memory);
+		fprintf(out, " pixels: %.1f (high: %.1f) palette: %.1f",
+			bytes_to_kib(pixel_memory.live),
+			bytes_to_kib(pixel_memory.high_water),
+			bytes_to_kib(pixel_memory.palette));
+	}
+	uint64_t allocations, bytes;
+	if (alloc_or_die_counts(&allocations, &bytes)) {
+		fprintf(out, " allocs: %" PRIu64 " (%.1f)", allocations,
+			bytes_to_kib(bytes));
+	}
+}
+
 void pixel_buffer_update(coordinate_plane_s *plane, pixel_buffer_s *buf)
 {
 	uint32_t plane_win_width = coordinate_plane_win_width(plane);
@@ -184,15 +390,83 @@ void pixel_buffer_update(coordinate_plane_s *plane, pixel_buffer_s *buf)
 		    plane_win_height, buf->height);
 	}
 
-	for (uint32_t y = 0; y < plane_win_height; y++) {
-		for (uint32_t x = 0; x < plane_win_width; x++) {
-			size_t escaped = coordinate_plane_escaped(plane, x, y);
-			size_t palette_idx = escaped % buf->palette_len;
-			rgb24_s color = buf->palette[palette_idx];
-			uint32_t foreground = rgb24_to_uint32(color);
-			*(buf->pixels + (y * buf->width) + x) = foreground;
+	const uint32_t *escaped = coordinate_plane_escaped_view(plane);
+	size_t len = (size_t)plane_win_width * plane_win_height;
+	for (size_t i = 0; i < len; ++i) {
+		size_t palette_idx = escaped[i] % buf->palette_len;
+		rgb24_s color = buf->palette[palette_idx];
+		buf->pixels[i] = rgb24_to_uint32(color);
+	}
+
+	if (coordinate_plane_function_converges(plane)) {
+		for (uint32_t y = 0; y < plane_win_height; ++y) {
+			for (uint32_t x = 0; x < plane_win_width; ++x) {
+				size_t i = ((size_t)y * plane_win_width) + x;
+				uint32_t root;
+				root = coordinate_plane_root(plane, x, y);
+				if (!root) {
+					continue;
+				}
+				rgb24_s color;
+				root_gradiant(&color, root, escaped[i]);
+				buf->pixels[i] = rgb24_to_uint32(color);
+			}
 		}
 	}
+
+	const uint32_t *costs = coordinate_plane_costs_view(plane);
+	if (!costs) {
+		return;
+	}
+	double log_max = log1p(max_cost(costs, len));
+	for (size_t i = 0; i < len; ++i) {
+		rgb24_s color;
+		rgb24_from_uint32(&color, buf->pixels[i]);
+		rgb24_s heat;
+		heat_gradiant(&heat, costs[i], log_max);
+		/* mostly heat, with enough of the image to see where */
+		color.red = ((3 * heat.red) + color.red) / 4;
+		color.green = ((3 * heat.green) + color.green) / 4;
+		color.blue = ((3 * heat.blue) + color.blue) / 4;
+		buf->pixels[i] = rgb24_to_uint32(color);
+	}
+}
+
+int coordinate_plane_write_heatmap_ppm(coordinate_plane_s *plane, FILE *out)
+{
+	const uint32_t *costs = coordinate_plane_costs_view(plane);
+	if (!costs) {
+		return 1;
+	}
+	uint32_t width = coordinate_plane_win_width(plane);
+	uint32_t height = coordinate_plane_win_height(plane);
+	size_t len = (size_t)width * height;
+	double log_max = log1p(max_cost(costs, len));
+
+	fprintf(out, "P6\n%" PRIu32 " %" PRIu32 "\n255\n", width, height);
+	for (size_t i = 0; i < len; ++i) {
+		rgb24_s heat;
+		heat_gradiant(&heat, costs[i], log_max);
+		fputc(heat.red, out);
+		fputc(heat.green, out);
+		fputc(heat.blue, out);
+	}
+	return ferror(out) ? 1 : 0;
+}
+
+/* binary "P6" portable pixmap, 8 bits per channel */
+int pixel_buffer_write_ppm(pixel_buffer_s *buf, FILE *out)
+{
+	fprintf(out, "P6\n%" PRIu32 " %" PRIu32 "\n255\n", buf->width,
+		buf->height);
+	for (size_t i = 0; i < buf->pixels_len; ++i) {
+		rgb24_s rgb;
+		rgb24_from_uint32(&rgb, buf->pixels[i]);
+		fputc(rgb.red, out);
+		fputc(rgb.green, out);
+		fputc(rgb.blue, out);
+	}
+	return ferror(out) ? 1 : 0;
 }
 
 void *pixel_buffer_resize(pixel_buffer_s *buf, int height, int width)
@@ -208,6 +482,9 @@ void *pixel_buffer_resize(pixel_buffer_s *buf, int height, int width)
 
 	alloc_or_die(&buf->pixels, size);
 
+	pixel_buffer_memory_s memory;
+	pixel_buffer_memory_usage(buf, &memory);
+
 	return buf->pixels;
 }
 
@@ -245,11 +522,12 @@ pixel_buffer_s *pixel_buffer_new(uint32_t window_x, uint32_t window_y,
 	size_t size = sizeof(pixel_buffer_s);
 	alloc_or_die(&buf, size);
 
-	buf->bytes_per_pixel = sizeof(uint32_t);
-	pixel_buffer_resize(buf, window_y, window_x);
-
+	buf->pixels = NULL;
 	buf->palette = NULL;
 	buf->palette_len = 0;
+	buf->memory_high_water = 0;
+	buf->bytes_per_pixel = sizeof(uint32_t);
+	pixel_buffer_resize(buf, window_y, window_x);
 
 	buf->palette =
 	    grow_palette(buf->palette, &buf->palette_len, skip_rounds,
@@ -258,6 +536,8 @@ pixel_buffer_s *pixel_buffer_new(uint32_t window_x, uint32_t window_y,
 		size_t size = sizeof(rgb24_s) * palette_len;
 		die("palette == NULL? (size %zu)", size);
 	}
+	pixel_buffer_memory_s memory;
+	pixel_buffer_memory_usage(buf, &memory);
 
 	return buf;
 }
@@ -273,6 +553,28 @@ pixel_buffer_s *pixel_buffer_new_from_plane(coordinate_plane_s *plane,
 	return buf;
 }
 
+/* also raises the high water mark, if need be */
+void pixel_buffer_memory_usage(pixel_buffer_s *buf, pixel_buffer_memory_s *out)
+{
+	out->buffer = sizeof(pixel_buffer_s);
+	out->pixels = buf->pixels ?
+	    (buf->pixels_len * buf->bytes_per_pixel) : 0;
+	out->palette = buf->palette ? (buf->palette_len * sizeof(rgb24_s)) : 0;
+	out->live = out->buffer + out->pixels + out->palette;
+	if (out->live > buf->memory_high_water) {
+		buf->memory_high_water = out->live;
+	}
+	out->high_water = buf->memory_high_water;
+}
+
+size_t pixel_buffer_memory_needed(uint32_t window_x, uint32_t window_y,
+				  size_t palette_len)
+{
+	size_t pixels = (size_t)window_x * window_y;
+	return sizeof(pixel_buffer_s) + (pixels * sizeof(uint32_t)) +
+	    (palette_len * sizeof(rgb24_s));
+}
+
 void pixel_buffer_free(pixel_buffer_s *buf)
 {
 	if (!buf) {
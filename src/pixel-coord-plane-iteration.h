@@ -5,6 +5,8 @@
 #ifndef PIXEL_COORD_PLANE_INTERATION_H
 #define PIXEL_COORD_PLANE_INTERATION_H 1
 
+#include <stdio.h>
+
 #include <rgb-hsv.h>
 #include <coord-plane-iteration.h>
 
@@ -13,6 +15,17 @@ typedef struct keyboard_key {
 	uint32_t was_down:1;
 } keyboard_key_s;
 
+/* what an input did to the view, for input latency */
+enum human_input_action {
+	human_input_action_none = 0,
+	human_input_action_pan,
+	human_input_action_zoom,
+	human_input_action_recenter,
+	human_input_action_function,
+	human_input_action_other,
+	human_input_action_len
+};
+
 typedef struct human_input {
 	keyboard_key_s up;
 	keyboard_key_s w;
@@ -35,6 +48,8 @@ typedef struct human_input {
 	keyboard_key_s m;
 	keyboard_key_s n;
 
+	keyboard_key_s h;
+
 	keyboard_key_s q;
 	keyboard_key_s space;
 	keyboard_key_s esc;
@@ -44,6 +59,11 @@ typedef struct human_input {
 	uint32_t click_y;
 
 	int wheel_zoom;
+
+	/* when the earliest of these inputs happened, 0 if unknown */
+	uint64_t event_nsec;
+	/* set by human_input_process */
+	enum human_input_action action;
 } human_input_s;
 
 enum coordinate_plane_change {
@@ -62,17 +82,61 @@ typedef struct pixel_buffer {
 	uint32_t *pixels;
 	rgb24_s *palette;
 	size_t palette_len;
+	/* the most bytes held at once, see pixel_buffer_memory_usage */
+	size_t memory_high_water;
 } pixel_buffer_s;
 
+/* as coordinate_plane_memory_s, for a pixel buffer */
+typedef struct pixel_buffer_memory {
+	size_t buffer;
+	size_t pixels;
+	size_t palette;
+	size_t live;
+	size_t high_water;
+} pixel_buffer_memory_s;
+
+/* log2 buckets of microseconds: bucket b is under 2^(b+1) usec */
+#define input_latency_buckets 24
+
+/* from an input event until the first present which shows its effect */
+typedef struct input_latency {
+	uint64_t counts[human_input_action_len][input_latency_buckets];
+	uint64_t total[human_input_action_len];
+	uint64_t max_nsec[human_input_action_len];
+} input_latency_s;
+
 void human_input_init(human_input_s *input);
 
+const char *human_input_action_name(enum human_input_action action);
+
 enum coordinate_plane_change human_input_process(human_input_s *input,
 						 coordinate_plane_s *plane);
 
 void print_directions(coordinate_plane_s *plane, FILE *out);
 
+void print_phase_times(coordinate_plane_s *plane, FILE *out);
+
+void input_latency_clear(input_latency_s *latency);
+
+void input_latency_add(input_latency_s *latency,
+		       enum human_input_action action, uint64_t nsec);
+
+/* count, p50, p99 and max per action, then each histogram */
+void print_input_latency(input_latency_s *latency, FILE *out);
+
+/* live and high water bytes of the plane and buf (which may be NULL),
+   and what alloc_or_die has counted, if it was built to count */
+void print_memory_usage(coordinate_plane_s *plane, pixel_buffer_s *buf,
+			FILE *out);
+
 void pixel_buffer_update(coordinate_plane_s *plane, pixel_buffer_s *buf);
 
+int pixel_buffer_write_ppm(pixel_buffer_s *buf, FILE *out);
+
+/* the recorded per-point costs alone, as a binary PPM; returns non-zero
+   on error or if the plane is not recording costs */
+int coordinate_plane_write_heatmap_ppm(coordinate_plane_s *plane, FILE *out);
+
 void *pixel_buffer_resize(pixel_buffer_s *buf, int height, int width);
 
 pixel_buffer_s *pixel_buffer_new(uint32_t window_x, uint32_t window_y,
@@ -81,6 +145,13 @@ pixel_buffer_s *pixel_buffer_new(uint32_t window_x, uint32_t window_y,
 pixel_buffer_s *pixel_buffer_new_from_plane(coordinate_plane_s *plane,
 					    size_t palette_len);
 
+void pixel_buffer_memory_usage(pixel_buffer_s *buf,
+			       pixel_buffer_memory_s *out);
+
+/* the live bytes of a new pixel buffer, before creating it */
+size_t pixel_buffer_memory_needed(uint32_t window_x, uint32_t window_y,
+				  size_t palette_len);
+
 void pixel_buffer_free(pixel_buffer_s *buf);
 
 #endif /* PIXEL_COORD_PLANE_INTERATION_H */
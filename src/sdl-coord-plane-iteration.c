@@ -15,28 +15,25 @@
 
 #define SDL_COORD_PLANE_ITERATION_VERSION "0.1.1"
 
+#include <errno.h>
 #include <signal.h>
-#include <sys/time.h>
+#include <stdlib.h>
+#include <string.h>
 #include <SDL.h>
 
 #include <alloc-or-die.h>
+#include <frame-pacer.h>
+#include <trace-events.h>
+#include <perf-counters.h>
 #include <coord-plane-option-parser.h>
 #include <pixel-coord-plane-iteration.h>
+#include <coord-plane-metrics.h>
+#include <input-recording.h>
 
 #ifndef Make_valgrind_happy
 #define Make_valgrind_happy 0
 #endif
 
-uint64_t time_in_usec(void)
-{
-	struct timeval tv = { 0, 0 };
-	struct timezone *tz = NULL;
-	gettimeofday(&tv, tz);
-	uint64_t usec_per_sec = (1000 * 1000);
-	uint64_t time_in_micros = (usec_per_sec * tv.tv_sec) + tv.tv_usec;
-	return time_in_micros;
-}
-
 typedef struct sdl_texture_buffer {
 	SDL_Texture *texture;
 	pixel_buffer_s *pixel_buf;
@@ -49,16 +46,103 @@ typedef struct sdl_event_context {
 	SDL_Renderer *renderer;
 	SDL_Event *event;
 	bool resized;
+	/* a replay takes the size of each frame from the recording */
+	bool replaying;
 } sdl_event_context_s;
 
-static void sdl_resize_texture_buf(SDL_Window *window,
-				   SDL_Renderer *renderer,
-				   sdl_texture_buffer_s *texture_buf)
+/* every frame of a headless run, for the statistics at the end */
+typedef struct sdl_frame_times {
+	uint64_t *nsec;
+	size_t len;
+	size_t size;
+	uint64_t colourize_nsec;
+	uint64_t upload_nsec;
+	uint64_t present_nsec;
+} sdl_frame_times_s;
+
+static void sdl_frame_times_add(sdl_frame_times_s *times, uint64_t frame_nsec,
+				uint64_t colourize_nsec, uint64_t upload_nsec,
+				uint64_t present_nsec)
 {
-	pixel_buffer_s *pixel_buf = texture_buf->pixel_buf;
+	if (times->len == times->size) {
+		size_t size = times->size ? (2 * times->size) : 1024;
+		uint64_t *grow = realloc(times->nsec, size * sizeof(uint64_t));
+		if (!grow) {
+			die("could not allocate %zu frame times", size);
+		}
+		times->nsec = grow;
+		times->size = size;
+	}
+	times->nsec[times->len++] = frame_nsec;
+	times->colourize_nsec += colourize_nsec;
+	times->upload_nsec += upload_nsec;
+	times->present_nsec += present_nsec;
+}
 
-	int height, width;
-	SDL_GetWindowSize(window, &width, &height);
+static int sdl_compare_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+static void sdl_frame_times_print(sdl_frame_times_s *times,
+				  SDL_Renderer *renderer, FILE *out)
+{
+	SDL_RendererInfo info;
+	if (SDL_GetRendererInfo(renderer, &info)) {
+		info.name = "?";
+	}
+	fprintf(out, "headless: video %s renderer %s frames %zu",
+		SDL_GetCurrentVideoDriver(), info.name, times->len);
+	if (!times->len) {
+		fprintf(out, "\n");
+		return;
+	}
+	size_t len = times->len;
+	qsort(times->nsec, len, sizeof(uint64_t), sdl_compare_u64);
+	uint64_t total = 0;
+	for (size_t i = 0; i < len; ++i) {
+		total += times->nsec[i];
+	}
+	double msec = 1000.0 * 1000.0;
+	fprintf(out, "\nms per frame: mean %.3f p50 %.3f p95 %.3f p99 %.3f"
+		" max %.3f\n", (total / msec) / len,
+		times->nsec[len / 2] / msec,
+		times->nsec[(len * 95) / 100] / msec,
+		times->nsec[(len * 99) / 100] / msec,
+		times->nsec[len - 1] / msec);
+	fprintf(out, "ms per frame: colourize %.3f upload %.3f present %.3f\n",
+		(times->colourize_nsec / msec) / len,
+		(times->upload_nsec / msec) / len,
+		(times->present_nsec / msec) / len);
+}
+
+/* no display needed: the offscreen driver if SDL has it, else dummy;
+   the environment rather than SDL_HINT_VIDEODRIVER, which is only in
+   SDL 2.0.22 and later */
+static void sdl_init_headless(Uint32 init_flags)
+{
+	const char *drivers[] = { "offscreen", "dummy" };
+	size_t drivers_len = sizeof(drivers) / sizeof(drivers[0]);
+	for (size_t i = 0; i < drivers_len; ++i) {
+		if (setenv("SDL_VIDEODRIVER", drivers[i], 1)) {
+			die("setenv(SDL_VIDEODRIVER, %s) failed (%s)",
+			    drivers[i], strerror(errno));
+		}
+		if (SDL_Init(init_flags) == 0) {
+			return;
+		}
+	}
+	die("Could not SDL_Init(%lu) headless (%s)", (uint64_t)init_flags,
+	    SDL_GetError());
+}
+
+static void sdl_resize_texture(SDL_Renderer *renderer,
+			       sdl_texture_buffer_s *texture_buf, int width,
+			       int height)
+{
+	pixel_buffer_s *pixel_buf = texture_buf->pixel_buf;
 
 	if (texture_buf->texture && ((width == (int)pixel_buf->width)
 				     && (height == (int)pixel_buf->height))) {
@@ -83,6 +167,26 @@ static void sdl_resize_texture_buf(SDL_Window *window,
 	}
 }
 
+static void sdl_resize_texture_buf(SDL_Window *window,
+				   SDL_Renderer *renderer,
+				   sdl_texture_buffer_s *texture_buf)
+{
+	int height, width;
+	SDL_GetWindowSize(window, &width, &height);
+	sdl_resize_texture(renderer, texture_buf, width, height);
+}
+
+/* a paced replay waits for each frame's time, as it was recorded */
+static void sdl_replay_wait(uint64_t until_nsec)
+{
+	uint64_t now = coordinate_plane_time_in_nsec();
+	if (until_nsec > now) {
+		uint64_t nsec_per_msec = (1000 * 1000);
+		SDL_Delay((until_nsec - now) / nsec_per_msec);
+	}
+}
+
+/* does not present, so that time waiting on vsync can be told apart */
 static void sdl_blit_bytes(SDL_Renderer *renderer, SDL_Texture *texture,
 			   const void *pixels, int pitch)
 {
@@ -93,7 +197,6 @@ static void sdl_blit_bytes(SDL_Renderer *renderer, SDL_Texture *texture,
 	const SDL_Rect *srcrect = NULL;
 	const SDL_Rect *dstrect = NULL;
 	SDL_RenderCopy(renderer, texture, srcrect, dstrect);
-	SDL_RenderPresent(renderer);
 }
 
 static void sdl_blit_texture(SDL_Renderer *renderer,
@@ -106,6 +209,22 @@ static void sdl_blit_texture(SDL_Renderer *renderer,
 	sdl_blit_bytes(renderer, texture, pixels, pitch);
 }
 
+/* SDL stamps events in milliseconds as they are queued; the time spent
+   in the queue is taken from when the event is polled */
+static void sdl_stamp_input(sdl_event_context_s *event_ctx,
+			    human_input_s *input)
+{
+	uint64_t nsec_per_msec = (1000 * 1000);
+	uint64_t now = coordinate_plane_time_in_nsec();
+	Uint32 ticks = SDL_GetTicks();
+	Uint32 queued = event_ctx->event->common.timestamp;
+	uint64_t waited = (ticks > queued) ? (ticks - queued) : 0;
+	uint64_t happened = now - (waited * nsec_per_msec);
+	if (!input->event_nsec || happened < input->event_nsec) {
+		input->event_nsec = happened;
+	}
+}
+
 static void sdl_process_key_event(sdl_event_context_s *event_ctx,
 				  human_input_s *input)
 {
@@ -155,6 +274,10 @@ static void sdl_process_key_event(sdl_event_context_s *event_ctx,
 		input->d.is_down = is_down;
 		input->d.was_down = was_down;
 		break;
+	case SDL_SCANCODE_H:
+		input->h.is_down = is_down;
+		input->h.was_down = was_down;
+		break;
 	case SDL_SCANCODE_M:
 		input->m.is_down = is_down;
 		input->m.was_down = was_down;
@@ -220,12 +343,16 @@ static int sdl_process_event(sdl_event_context_s *event_ctx,
 		break;
 	case SDL_KEYUP:
 	case SDL_KEYDOWN:
+		sdl_stamp_input(event_ctx, input);
 		sdl_process_key_event(event_ctx, input);
 		break;
-	case SDL_MOUSEMOTION:
 	case SDL_MOUSEBUTTONDOWN:
-	case SDL_MOUSEBUTTONUP:
 	case SDL_MOUSEWHEEL:
+		sdl_stamp_input(event_ctx, input);
+		sdl_process_mouse_event(event_ctx, input);
+		break;
+	case SDL_MOUSEMOTION:
+	case SDL_MOUSEBUTTONUP:
 		sdl_process_mouse_event(event_ctx, input);
 		break;
 	case SDL_WINDOWEVENT:
@@ -251,6 +378,9 @@ static int sdl_process_event(sdl_event_context_s *event_ctx,
 			/* window resized to data1 x data2 */
 			/* always preceded by */
 			/* SDL_WINDOWEVENT_SIZE_CHANGED */
+			if (event_ctx->replaying) {
+				break;
+			}
 			sdl_resize_texture_buf(event_ctx->window,
 					       event_ctx->renderer,
 					       event_ctx->texture_buf);
@@ -301,13 +431,16 @@ static int sdl_process_event(sdl_event_context_s *event_ctx,
 }
 
 void sdl_coord_plane_iteration(coordinate_plane_s *plane,
-			       pixel_buffer_s *virtual_win)
+			       pixel_buffer_s *virtual_win,
+			       const coord_options_s *options)
 {
 	int window_x = coordinate_plane_win_width(plane);
 	int window_y = coordinate_plane_win_height(plane);
 
 	Uint32 init_flags = SDL_INIT_VIDEO;
-	if (SDL_Init(init_flags) != 0) {
+	if (options->headless) {
+		sdl_init_headless(init_flags);
+	} else if (SDL_Init(init_flags) != 0) {
 		die("Could not SDL_Init(%lu) (%s)", (uint64_t)init_flags,
 		    SDL_GetError());
 	}
@@ -322,6 +455,9 @@ void sdl_coord_plane_iteration(coordinate_plane_s *plane,
 	int x = SDL_WINDOWPOS_UNDEFINED;
 	int y = SDL_WINDOWPOS_UNDEFINED;
 	Uint32 win_flags = SDL_WINDOW_RESIZABLE;
+	if (options->headless) {
+		win_flags |= SDL_WINDOW_HIDDEN;
+	}
 	const char *title = coordinate_plane_function_name(plane);
 	SDL_Window *window =
 	    SDL_CreateWindow(title, x, y, window_x, window_y, win_flags);
@@ -331,6 +467,11 @@ void sdl_coord_plane_iteration(coordinate_plane_s *plane,
 
 	const int renderer_idx = -1;	// first renderer
 	Uint32 rend_flags = 0;
+	if (options->headless) {
+		rend_flags |= SDL_RENDERER_SOFTWARE;
+	} else if (options->vsync) {
+		rend_flags |= SDL_RENDERER_PRESENTVSYNC;
+	}
 	SDL_Renderer *renderer =
 	    SDL_CreateRenderer(window, renderer_idx, rend_flags);
 	if (!renderer) {
@@ -347,8 +488,11 @@ void sdl_coord_plane_iteration(coordinate_plane_s *plane,
 	event_ctx.window = window;
 	event_ctx.win_id = SDL_GetWindowID(window);
 	event_ctx.resized = false;
+	event_ctx.replaying = (options->replay != NULL);
 
-	uint32_t it_per_frame = 1;
+	frame_pacer_s pacer;
+	frame_pacer_init(&pacer, options->fps);
+	uint32_t it_per_frame = pacer.it_per_frame;
 	uint64_t usec_per_sec = (1000 * 1000);
 	uint64_t last_print = 0;
 	uint64_t iterations_at_last_print = 0;
@@ -362,6 +506,47 @@ void sdl_coord_plane_iteration(coordinate_plane_s *plane,
 	human_input_s *new_input = &input[1];
 	human_input_s *old_input = &input[0];
 
+	/* inputs whose effect has not yet been presented, by action */
+	input_latency_s latency;
+	input_latency_clear(&latency);
+	uint64_t latency_pending[human_input_action_len] = { 0 };
+
+	coordinate_plane_metrics_s metrics;
+	if (coordinate_plane_metrics_init(&metrics, options->metrics,
+					  options->metrics_csv,
+					  options->metrics_interval)) {
+		die("%s", "could not start metrics");
+	}
+
+	FILE *record = NULL;
+	if (options->record) {
+		record = fopen(options->record, "w");
+		if (!record) {
+			die("could not open '%s' (%s)", options->record,
+			    strerror(errno));
+		}
+		human_input_recording_header(record, plane);
+	}
+	FILE *replay = NULL;
+	if (options->replay) {
+		replay = fopen(options->replay, "r");
+		if (!replay) {
+			die("could not open '%s' (%s)", options->replay,
+			    strerror(errno));
+		}
+	}
+	uint64_t session_start = coordinate_plane_time_in_nsec();
+	uint64_t replayed_frames = 0;
+
+	/* a headless run of a fixed scene needs an end */
+	sdl_frame_times_s frame_times = { NULL, 0, 0, 0, 0, 0 };
+	uint64_t max_frames = 0;
+	if (options->headless && !replay
+	    && !coordinate_plane_halt_after(plane)) {
+		max_frames = 1000;
+	}
+
+	uint64_t last_frame = coordinate_plane_time_in_nsec();
 	int shutdown = 0;
 	while (!shutdown) {
 		tmp_input = new_input;
@@ -379,12 +564,36 @@ void sdl_coord_plane_iteration(coordinate_plane_s *plane,
 			break;
 		}
 
+		human_input_frame_s frame;
+		if (replay) {
+			int read = human_input_frame_read(replay, &frame);
+			if (read <= 0) {
+				shutdown = 1;
+				break;
+			}
+			if (!options->replay_bench) {
+				sdl_replay_wait(session_start + frame.nsec);
+			}
+			*new_input = frame.input;
+			new_input->event_nsec = coordinate_plane_time_in_nsec();
+			++replayed_frames;
+		}
+
 		enum coordinate_plane_change change =
 		    human_input_process(new_input, plane);
 		if (change == coordinate_plane_change_shutdown) {
 			shutdown = 1;
 			break;
 		}
+		if (new_input->action != human_input_action_none) {
+			uint64_t happened = new_input->event_nsec ?
+			    new_input->event_nsec :
+			    coordinate_plane_time_in_nsec();
+			uint64_t *pending = latency_pending + new_input->action;
+			if (!*pending || happened < *pending) {
+				*pending = happened;
+			}
+		}
 		if (event_ctx.resized) {
 			SDL_GetWindowSize(window, &window_x, &window_y);
 			bool preseve_ratio = false;
@@ -393,52 +602,111 @@ void sdl_coord_plane_iteration(coordinate_plane_s *plane,
 			change = coordinate_plane_change_yes;
 			event_ctx.resized = false;
 		}
+		/* compared with the plane, not the window, which the window
+		   manager may have sized otherwise */
+		uint32_t plane_x = coordinate_plane_win_width(plane);
+		uint32_t plane_y = coordinate_plane_win_height(plane);
+		if (replay && ((frame.width != plane_x)
+			       || (frame.height != plane_y))) {
+			window_x = frame.width;
+			window_y = frame.height;
+			SDL_SetWindowSize(window, window_x, window_y);
+			sdl_resize_texture(renderer, &texture_buf, window_x,
+					   window_y);
+			bool preseve_ratio = false;
+			coordinate_plane_resize(plane, window_x, window_y,
+						preseve_ratio);
+			change = coordinate_plane_change_yes;
+		}
 		if (change == coordinate_plane_change_yes) {
 			iterations_at_last_print = 0;
+			frame_pacer_reset(&pacer);
+			it_per_frame = pacer.it_per_frame;
 			title = coordinate_plane_function_name(plane);
 			SDL_SetWindowTitle(window, title);
 			print_directions(plane, stdout);
 			fflush(stdout);
 		}
-		// set a 32 frames per second target
-		uint64_t usec_per_frame_high_threshold = usec_per_sec / 30;
-		uint64_t usec_per_frame_low_threshold = usec_per_sec / 45;
-		uint64_t before = time_in_usec();
 
+		if (replay) {
+			it_per_frame = frame.it_per_frame;
+		}
+		if (record) {
+			frame.nsec = coordinate_plane_time_in_nsec() -
+			    session_start;
+			frame.width = coordinate_plane_win_width(plane);
+			frame.height = coordinate_plane_win_height(plane);
+			frame.it_per_frame = it_per_frame;
+			frame.input = *new_input;
+			if (human_input_frame_write(record, &frame)) {
+				die("could not write '%s' (%s)",
+				    options->record, strerror(errno));
+			}
+		}
+
+		uint64_t before = time_in_usec();
+		uint64_t it_before = coordinate_plane_iteration_count(plane);
 		coordinate_plane_iterate(plane, it_per_frame);
 		uint64_t it_count = coordinate_plane_iteration_count(plane);
+		uint64_t computed = time_in_usec();
 		if (coordinate_plane_halt_after(plane) &&
 		    (it_count >= coordinate_plane_halt_after(plane))) {
 			shutdown = 1;
 		}
+		uint64_t phase_start = coordinate_plane_time_in_nsec();
+		perf_counters_begin(perf_counters_phase_colourize);
 		pixel_buffer_update(plane, virtual_win);
+		perf_counters_end(perf_counters_phase_colourize);
+		uint64_t colourized = coordinate_plane_time_in_nsec();
 
 		sdl_blit_texture(renderer, &texture_buf);
+		uint64_t blitted = time_in_usec();
+		uint64_t uploaded = coordinate_plane_time_in_nsec();
+		SDL_RenderPresent(renderer);
+		uint64_t presented = coordinate_plane_time_in_nsec();
+		coordinate_plane_stats_add_phase(plane,
+						 coordinate_plane_phase_colourize,
+						 colourized - phase_start);
+		coordinate_plane_stats_add_phase(plane,
+						 coordinate_plane_phase_upload,
+						 uploaded - colourized);
+		coordinate_plane_stats_add_phase(plane,
+						 coordinate_plane_phase_present,
+						 presented - uploaded);
+		coordinate_plane_stats_add_frame(plane, presented - last_frame);
+		trace_event_complete("colourize", phase_start, colourized);
+		trace_event_complete("upload", colourized, uploaded);
+		trace_event_complete("present", uploaded, presented);
+		for (size_t a = 0; a < human_input_action_len; ++a) {
+			uint64_t pending = latency_pending[a];
+			if (pending) {
+				input_latency_add(&latency, a,
+						  presented - pending);
+				trace_event_complete("input_latency", pending,
+						     presented);
+				latency_pending[a] = 0;
+			}
+		}
+		trace_events_poll();
+		coordinate_plane_metrics_update(&metrics, plane, virtual_win);
+		if (options->headless) {
+			sdl_frame_times_add(&frame_times,
+					    presented - last_frame,
+					    colourized - phase_start,
+					    uploaded - colourized,
+					    presented - uploaded);
+		}
+		last_frame = presented;
 		++frame_count;
 		++frames_since_print;
+		if (max_frames && frame_count >= max_frames) {
+			shutdown = 1;
+		}
 
 		uint64_t now = time_in_usec();
-		uint64_t diff = now - before;
-		if (diff < usec_per_frame_low_threshold) {
-			++it_per_frame;
-		} else if ((diff > usec_per_frame_high_threshold)
-			   && (it_per_frame > 1)) {
-			if (it_per_frame < 10) {
-				--it_per_frame;
-			} else {
-				double ht = 1.0 * usec_per_frame_high_threshold;
-				double ratio = ht / diff;
-				uint32_t new_per_frame = it_per_frame * ratio;
-				if (new_per_frame >= it_per_frame) {
-					--it_per_frame;
-				} else {
-					it_per_frame = new_per_frame;
-				}
-				if (it_per_frame == 0) {
-					it_per_frame = 1;
-				}
-			}
-		}
+		it_per_frame = frame_pacer_update(&pacer, it_count - it_before,
+						  computed - before,
+						  blitted - computed);
 
 		uint64_t elapsed_since_last_print = now - last_print;
 		if (shutdown || elapsed_since_last_print > usec_per_sec) {
@@ -469,14 +737,41 @@ void sdl_coord_plane_iteration(coordinate_plane_s *plane,
 					"i:%" PRIu64 " escaped: %" PRIu64
 					" not: %" PRIu64
 					" (ips: %.f fps: %.f ipf: %" PRIu32
-					" thds: %zu)     \r", it_count, escaped,
+					" thds: %zu) ", it_count, escaped,
 					not_escaped, ips, fps, it_per_frame,
 					num_threads);
+				print_phase_times(plane, stdout);
+				fprintf(stdout, "     \r");
 				fflush(stdout);
+				coordinate_plane_stats_clear(plane);
 			}
 		}
 	}
 	fprintf(stdout, "\n");
+	if (replay) {
+		double seconds = (coordinate_plane_time_in_nsec() -
+				  session_start) / (1000.0 * 1000.0 * 1000.0);
+		fprintf(stdout, "replayed %" PRIu64 " frames in %.3f seconds"
+			" (%.1f fps), i:%" PRIu64 " escaped: %zu not: %zu\n",
+			replayed_frames, seconds, replayed_frames / seconds,
+			coordinate_plane_iteration_count(plane),
+			coordinate_plane_escaped_count(plane),
+			coordinate_plane_not_escaped_count(plane));
+		fclose(replay);
+	}
+	if (record && fclose(record)) {
+		logerror("could not write '%s' (%s)", options->record,
+			 strerror(errno));
+	}
+	if (options->headless) {
+		sdl_frame_times_print(&frame_times, renderer, stdout);
+		free(frame_times.nsec);
+	}
+	print_input_latency(&latency, stdout);
+	print_memory_usage(plane, virtual_win, stdout);
+	fprintf(stdout, "\n");
+	coordinate_plane_metrics_write(&metrics, plane, virtual_win);
+	coordinate_plane_metrics_close(&metrics);
 
 	/* we probably do not need to do these next steps */
 	if (Make_valgrind_happy) {
@@ -495,14 +790,15 @@ int main(int argc, char **argv)
 	signal(SIGSEGV, backtrace_exit_handler);
 
 	const char *version = SDL_COORD_PLANE_ITERATION_VERSION;
+	coord_options_s options;
 	coordinate_plane_s *plane =
-	    coordinate_plane_new_from_args(argc, argv, version);
+	    coordinate_plane_new_from_args(argc, argv, version, &options);
 
 	size_t palette_len = 1024;
 	pixel_buffer_s *virtual_win =
 	    pixel_buffer_new_from_plane(plane, palette_len);
 
-	sdl_coord_plane_iteration(plane, virtual_win);
+	sdl_coord_plane_iteration(plane, virtual_win, &options);
 
 	if (Make_valgrind_happy) {
 		pixel_buffer_free(virtual_win);
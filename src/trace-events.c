@@ -0,0 +1,271 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* trace-events.c: Chrome trace-event JSON of begin/end events */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <signal.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifndef SKIP_THREADS
+#include <threads.h>
+#endif
+
+#include <logerr-die.h>
+#include <alloc-or-die.h>
+#include <trace-events.h>
+
+#define trace_events_ring_len (1U << 16)
+
+typedef struct trace_event {
+	const char *name;
+	uint64_t nsec;
+	/* 'B'egin, 'E'nd, or 'X' complete */
+	char phase;
+	/* a ring passes from thread to thread, so each event keeps its own */
+	uint32_t tid;
+	uint64_t dur_nsec;
+} trace_event_s;
+
+typedef struct trace_ring {
+	struct trace_ring *next;
+	/* claimed by a live thread; released, events and all, when it exits */
+	atomic_bool in_use;
+	uint32_t tid;
+	/* count of events ever recorded; only the owning thread stores */
+	atomic_uint_fast64_t head;
+	trace_event_s events[trace_events_ring_len];
+} trace_ring_s;
+
+static atomic_bool trace_enabled = false;
+static const char *trace_path = NULL;
+static uint64_t trace_start_nsec = 0;
+static _Atomic(trace_ring_s *) trace_rings = NULL;
+static atomic_uint_fast32_t trace_next_tid = 1;
+static volatile sig_atomic_t trace_dump_requested = 0;
+static _Thread_local trace_ring_s *trace_ring = NULL;
+#ifndef SKIP_THREADS
+static tss_t trace_ring_key;
+#endif
+
+uint64_t trace_events_time_in_nsec(void)
+{
+	struct timespec ts = { 0, 0 };
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	uint64_t nsec_per_sec = (1000 * 1000 * 1000);
+	return (nsec_per_sec * ts.tv_sec) + ts.tv_nsec;
+}
+
+static void trace_events_sigusr1_handler(int sig)
+{
+	(void)sig;
+	trace_dump_requested = 1;
+}
+
+static void trace_events_write_at_exit(void)
+{
+	trace_events_write();
+}
+
+#ifndef SKIP_THREADS
+/* the tss destructor: a ring outlives its thread, for the next one, and
+   its events stay in it for the dump until they are overwritten */
+static void trace_events_ring_release(void *arg)
+{
+	trace_ring_s *ring = arg;
+	atomic_store(&ring->in_use, false);
+}
+#endif
+
+int trace_events_start(const char *path)
+{
+	if (atomic_load(&trace_enabled)) {
+		return 0;
+	}
+#ifndef SKIP_THREADS
+	if (tss_create(&trace_ring_key, trace_events_ring_release)
+	    != thrd_success) {
+		logerror("%s", "tss_create(&trace_ring_key) failed");
+		return 1;
+	}
+#endif
+	trace_path = path;
+	trace_start_nsec = trace_events_time_in_nsec();
+	signal(SIGUSR1, trace_events_sigusr1_handler);
+	if (atexit(trace_events_write_at_exit)) {
+		logerror("%s", "atexit(trace_events_write_at_exit) failed");
+		return 1;
+	}
+	atomic_store(&trace_enabled, true);
+	return 0;
+}
+
+/* the first event of a thread claims a released ring or links a new
+   one; a pool rebuilt many times thus needs only as many rings as it
+   has ever had threads at once */
+static trace_ring_s *trace_events_ring(void)
+{
+	if (trace_ring) {
+		return trace_ring;
+	}
+	trace_ring_s *ring = NULL;
+	for (ring = atomic_load(&trace_rings); ring; ring = ring->next) {
+		bool expected = false;
+		if (atomic_compare_exchange_strong(&ring->in_use, &expected,
+						   true)) {
+			break;
+		}
+	}
+	if (!ring) {
+		malloc_or_log(&ring, sizeof(trace_ring_s));
+		if (!ring) {
+			return NULL;
+		}
+		atomic_init(&ring->in_use, true);
+		atomic_init(&ring->head, 0);
+		ring->next = atomic_load(&trace_rings);
+		while (!atomic_compare_exchange_weak(&trace_rings, &ring->next,
+						     ring)) {
+			/* ring->next now holds the current list head */
+		}
+	}
+	ring->tid = atomic_fetch_add(&trace_next_tid, 1);
+#ifndef SKIP_THREADS
+	tss_set(trace_ring_key, ring);
+#endif
+	trace_ring = ring;
+	return ring;
+}
+
+static void trace_events_record(const char *name, char phase, uint64_t nsec,
+				uint64_t dur_nsec)
+{
+	trace_ring_s *ring = trace_events_ring();
+	if (!ring) {
+		return;
+	}
+	uint_fast64_t head =
+	    atomic_load_explicit(&ring->head, memory_order_relaxed);
+	trace_event_s *event = ring->events + (head % trace_events_ring_len);
+	event->name = name;
+	event->nsec = nsec;
+	event->phase = phase;
+	event->tid = ring->tid;
+	event->dur_nsec = dur_nsec;
+	atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
+
+void trace_event_begin(const char *name)
+{
+	if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+		return;
+	}
+	trace_events_record(name, 'B', trace_events_time_in_nsec(), 0);
+}
+
+void trace_event_end(const char *name)
+{
+	if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+		return;
+	}
+	trace_events_record(name, 'E', trace_events_time_in_nsec(), 0);
+}
+
+void trace_event_complete(const char *name, uint64_t start_nsec,
+			  uint64_t end_nsec)
+{
+	if (!atomic_load_explicit(&trace_enabled, memory_order_relaxed)) {
+		return;
+	}
+	uint64_t dur = (end_nsec > start_nsec) ? (end_nsec - start_nsec) : 0;
+	trace_events_record(name, 'X', start_nsec, dur);
+}
+
+void trace_events_poll(void)
+{
+	if (trace_dump_requested) {
+		trace_dump_requested = 0;
+		trace_events_write();
+	}
+}
+
+static double trace_events_usec(uint64_t nsec)
+{
+	uint64_t rel = (nsec > trace_start_nsec) ? (nsec - trace_start_nsec) : 0;
+	return rel / 1000.0;
+}
+
+/*
+ Other threads may still be recording: only the events before each
+ ring's head at the time it is read are written. An event overwritten
+ while being written may come out garbled, but with a ring this size
+ that needs a thread to record 64k events during the write.
+*/
+int trace_events_write(void)
+{
+	if (!atomic_load(&trace_enabled) || !trace_path) {
+		return 0;
+	}
+
+	char tmp_path[4096];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", trace_path);
+	FILE *out = fopen(tmp_path, "w");
+	if (!out) {
+		logerror("could not open '%s' (%s)", tmp_path, strerror(errno));
+		return 1;
+	}
+
+	long pid = (long)getpid();
+	fprintf(out, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+	int first = 1;
+	for (trace_ring_s *ring = atomic_load(&trace_rings); ring;
+	     ring = ring->next) {
+		uint_fast64_t head =
+		    atomic_load_explicit(&ring->head, memory_order_acquire);
+		uint_fast64_t begin = (head > trace_events_ring_len)
+		    ? (head - trace_events_ring_len) : 0;
+		uint32_t named_tid = 0;
+		for (uint_fast64_t i = begin; i < head; ++i) {
+			trace_event_s *e =
+			    ring->events + (i % trace_events_ring_len);
+			if (e->tid != named_tid) {
+				/* each thread which held the ring in turn */
+				named_tid = e->tid;
+				fprintf(out, "%s{\"name\": \"thread_name\","
+					" \"ph\": \"M\", \"pid\": %ld,"
+					" \"tid\": %" PRIu32 ", \"args\":"
+					" {\"name\": \"thread %" PRIu32 "\"}}",
+					first ? "" : ",\n", pid, named_tid,
+					named_tid);
+				first = 0;
+			}
+			fprintf(out, ",\n{\"name\": \"%s\", \"ph\": \"%c\","
+				" \"ts\": %.3f, \"pid\": %ld, \"tid\": %"
+				PRIu32, e->name, e->phase,
+				trace_events_usec(e->nsec), pid, e->tid);
+			if (e->phase == 'X') {
+				fprintf(out, ", \"dur\": %.3f",
+					e->dur_nsec / 1000.0);
+			}
+			fprintf(out, "}");
+		}
+	}
+	fprintf(out, "\n]}\n");
+
+	if (fclose(out)) {
+		logerror("could not write '%s' (%s)", tmp_path,
+			 strerror(errno));
+		return 1;
+	}
+	if (rename(tmp_path, trace_path)) {
+		logerror("could not rename '%s' to '%s' (%s)", tmp_path,
+			 trace_path, strerror(errno));
+		return 1;
+	}
+	return 0;
+}
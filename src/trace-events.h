@@ -0,0 +1,40 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* trace-events.h: Chrome trace-event JSON of begin/end events */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+
+#ifndef TRACE_EVENTS_H
+#define TRACE_EVENTS_H 1
+
+#include <stdint.h>
+
+/*
+ Opt-in. Until trace_events_start is called every event call returns at
+ once. Each thread records into its own ring buffer, which it alone
+ writes, so recording takes no locks; when a ring is full the oldest
+ events are overwritten. The file is written at exit, and also when
+ trace_events_poll finds that SIGUSR1 has been received.
+ Names must be string literals (or otherwise outlive the program).
+ Load the file in chrome://tracing or https://ui.perfetto.dev
+*/
+
+/* returns 0 on success */
+int trace_events_start(const char *path);
+
+void trace_event_begin(const char *name);
+
+void trace_event_end(const char *name);
+
+/* for a span already timed with trace_events_time_in_nsec */
+void trace_event_complete(const char *name, uint64_t start_nsec,
+			  uint64_t end_nsec);
+
+/* CLOCK_MONOTONIC, the clock of the events */
+uint64_t trace_events_time_in_nsec(void);
+
+/* call from the main loop; writes the file if SIGUSR1 was received */
+void trace_events_poll(void);
+
+/* returns 0 on success */
+int trace_events_write(void);
+
+#endif /* TRACE_EVENTS_H */
@@ -0,0 +1,569 @@
+/* SPDX-License-Identifier: LGPL-3.0-or-later */
+/* validate-coord-plane-iteration.c: compare engines, pixel by pixel */
+/* Copyright (C) 2020 Eric Herman <eric@freesa.org> */
+/* https://github.com/ericherman/coord-plane-iteration */
+
+#define VALIDATE_COORD_PLANE_ITERATION_VERSION "0.1.0"
+
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <logerr-die.h>
+#include <alloc-or-die.h>
+#include <coord-plane-iteration.h>
+#include <coord-plane-render.h>
+#include <bench-scenes.h>
+
+/*
+ The reference is the plane itself, single threaded, iterated in one
+ call: the long double scalar path. A candidate fills the same escape
+ counts by some other route; a fast path is added here as another
+ candidate and compared before it is trusted.
+ A render function returns 0 on success, or non-zero if the engine
+ does not support the scene, which is then skipped.
+*/
+typedef int (*validate_render_f)(const bench_scene_s *scene, uint32_t width,
+				 uint32_t height, uint64_t iterations,
+				 uint32_t threads, uint32_t *out);
+
+typedef struct validate_engine {
+	const char *name;
+	const char *description;
+	validate_render_f render;
+} validate_engine_s;
+
+typedef struct validate_tile {
+	uint32_t x;
+	uint32_t y;
+	uint32_t width;
+	uint32_t height;
+	size_t mismatches;
+	uint32_t max_diff;
+} validate_tile_s;
+
+typedef struct validate_report {
+	const char *engine;
+	const bench_scene_s *scene;
+	uint32_t width;
+	uint32_t height;
+	size_t pixels;
+	size_t mismatches;
+	/* escaped in one engine, not in the other */
+	size_t escape_flips;
+	uint32_t max_diff;
+	double mean_diff;
+	double mismatch_pct;
+	int passed;
+} validate_report_s;
+
+typedef struct validate_options {
+	const char *format;
+	const char *scene;
+	const char *engines;
+	uint32_t width;
+	uint32_t height;
+	uint32_t threads;
+	uint64_t iterations;
+	uint32_t tolerance;
+	double max_mismatch_pct;
+	uint32_t tile;
+	size_t worst;
+	int help;
+	int version;
+} validate_options_s;
+
+static coordinate_plane_s *validate_plane_new(const bench_scene_s *scene,
+					      uint32_t width, uint32_t height,
+					      uint64_t iterations,
+					      uint32_t threads)
+{
+	long double resolution = scene->x_span / width;
+	uint32_t skip_rounds = 0;
+	return coordinate_plane_new("validate", width, height, scene->center,
+				    resolution, resolution, scene->pfuncs_idx,
+				    scene->seed, iterations, skip_rounds,
+				    threads);
+}
+
+static int validate_reference(const bench_scene_s *scene, uint32_t width,
+			      uint32_t height, uint64_t iterations,
+			      uint32_t threads, uint32_t *out)
+{
+	(void)threads;
+	coordinate_plane_s *plane =
+	    validate_plane_new(scene, width, height, iterations, 1);
+	while (coordinate_plane_iteration_count(plane) < iterations) {
+		uint64_t left =
+		    iterations - coordinate_plane_iteration_count(plane);
+		coordinate_plane_iterate(plane, (left > UINT32_MAX)
+					 ? UINT32_MAX : (uint32_t)left);
+	}
+	coordinate_plane_escaped_region(plane, NULL, out, 0);
+	coordinate_plane_free(plane);
+	return 0;
+}
+
+/* many threads and uneven chunk sizes, as the interactive frontends */
+static int validate_threaded(const bench_scene_s *scene, uint32_t width,
+			     uint32_t height, uint64_t iterations,
+			     uint32_t threads, uint32_t *out)
+{
+	coordinate_plane_s *plane =
+	    validate_plane_new(scene, width, height, iterations, threads);
+	uint32_t chunk = 1;
+	while (coordinate_plane_iteration_count(plane) < iterations) {
+		uint64_t left =
+		    iterations - coordinate_plane_iteration_count(plane);
+		coordinate_plane_iterate(plane, (left > chunk)
+					 ? chunk : (uint32_t)left);
+		chunk = (chunk < 1024) ? ((2 * chunk) + 1) : 1;
+	}
+	coordinate_plane_escaped_region(plane, NULL, out, 0);
+	coordinate_plane_free(plane);
+	return 0;
+}
+
+static int validate_librender(const bench_scene_s *scene, uint32_t width,
+			      uint32_t height, uint64_t iterations,
+			      uint32_t threads, uint32_t *out)
+{
+	coordinate_plane_renderer_s *renderer =
+	    coordinate_plane_renderer_new(threads);
+	if (!renderer) {
+		die("%s", "could not create a renderer");
+	}
+	coordinate_plane_view_s view;
+	view.center = scene->center;
+	view.resolution_x = scene->x_span / width;
+	view.resolution_y = view.resolution_x;
+	view.pfuncs_idx = scene->pfuncs_idx;
+	view.seed = scene->seed;
+	view.iterations = iterations;
+	int err = coordinate_plane_render(renderer, &view, width, height, out);
+	coordinate_plane_renderer_free(renderer);
+	if (err) {
+		die("coordinate_plane_render returned %d", err);
+	}
+	return 0;
+}
+
+/*
+ mandlebrot and julia in double rather than long double: not a fast
+ path we ship, but a known lower precision candidate which shows what
+ the report looks like when results drift. The point locations are
+ taken from a plane so that only the arithmetic differs.
+*/
+static int validate_double(const bench_scene_s *scene, uint32_t width,
+			   uint32_t height, uint64_t iterations,
+			   uint32_t threads, uint32_t *out)
+{
+	(void)threads;
+	bool julia = (scene->pfuncs_idx == pfuncs_julia_idx);
+	if (!julia && scene->pfuncs_idx != pfuncs_mandlebrot_idx) {
+		return 1;
+	}
+
+	coordinate_plane_s *plane =
+	    validate_plane_new(scene, width, height, iterations, 1);
+	long double x_min = coordinate_plane_x_min(plane);
+	long double y_max = coordinate_plane_y_max(plane);
+	long double res_x = coordinate_plane_resolution_x(plane);
+	long double res_y = coordinate_plane_resolution_y(plane);
+	coordinate_plane_free(plane);
+
+	for (uint32_t py = 0; py < height; ++py) {
+		long double ly = y_max - (py * res_y);
+		if (fabsl(ly) < (res_y / 2)) {
+			ly = 0.0;
+		}
+		for (uint32_t px = 0; px < width; ++px) {
+			long double lx = x_min + (px * res_x);
+			if (fabsl(lx) < (res_x / 2)) {
+				lx = 0.0;
+			}
+			double cx = julia ? scene->seed.x : lx;
+			double cy = julia ? scene->seed.y : ly;
+			double zx = julia ? lx : 0.0;
+			double zy = julia ? ly : 0.0;
+			uint32_t escaped = 0;
+			for (uint64_t i = 0; i < iterations && !escaped; ++i) {
+				if (((zx * zx) + (zy * zy)) > 4.0) {
+					escaped = i + 1;
+				} else {
+					double x = (zx * zx) - (zy * zy) + cx;
+					zy = (2.0 * zx * zy) + cy;
+					zx = x;
+				}
+			}
+			out[(py * width) + px] = escaped;
+		}
+	}
+	return 0;
+}
+
+static const validate_engine_s validate_engines[] = {
+	{ "threaded", "plane, many threads, uneven chunks",
+	 validate_threaded },
+	{ "render", "libcoordplane coordinate_plane_render",
+	 validate_librender },
+	{ "double", "scalar double precision, mandlebrot and julia only",
+	 validate_double },
+};
+
+static const size_t validate_engines_len =
+    (sizeof(validate_engines) / sizeof(validate_engines[0]));
+
+/* is name in the comma separated list */
+static int validate_in_list(const char *list, const char *name)
+{
+	size_t name_len = strlen(name);
+	const char *pos = list;
+	while (pos && *pos) {
+		const char *end = strchr(pos, ',');
+		size_t len = end ? (size_t)(end - pos) : strlen(pos);
+		if (len == name_len && strncmp(pos, name, len) == 0) {
+			return 1;
+		}
+		pos = end ? end + 1 : NULL;
+	}
+	return 0;
+}
+
+static void validate_compare(const uint32_t *reference,
+			     const uint32_t *candidate,
+			     validate_options_s *options,
+			     validate_report_s *report,
+			     validate_tile_s *tiles, size_t tiles_len)
+{
+	uint32_t width = report->width;
+	uint32_t tile = options->tile;
+	uint32_t tiles_across = (width + tile - 1) / tile;
+
+	for (size_t i = 0; i < tiles_len; ++i) {
+		uint32_t tx = i % tiles_across;
+		uint32_t ty = i / tiles_across;
+		tiles[i].x = tx * tile;
+		tiles[i].y = ty * tile;
+		tiles[i].width = ((tiles[i].x + tile) > width)
+		    ? (width - tiles[i].x) : tile;
+		tiles[i].height = ((tiles[i].y + tile) > report->height)
+		    ? (report->height - tiles[i].y) : tile;
+		tiles[i].mismatches = 0;
+		tiles[i].max_diff = 0;
+	}
+
+	uint64_t diff_sum = 0;
+	report->mismatches = 0;
+	report->escape_flips = 0;
+	report->max_diff = 0;
+	for (size_t i = 0; i < report->pixels; ++i) {
+		uint32_t a = reference[i];
+		uint32_t b = candidate[i];
+		if ((a == 0) != (b == 0)) {
+			++(report->escape_flips);
+		}
+		uint32_t diff = (a > b) ? (a - b) : (b - a);
+		if (diff <= options->tolerance) {
+			continue;
+		}
+		++(report->mismatches);
+		diff_sum += diff;
+		if (diff > report->max_diff) {
+			report->max_diff = diff;
+		}
+		uint32_t x = i % width;
+		uint32_t y = i / width;
+		validate_tile_s *t =
+		    tiles + ((y / tile) * tiles_across) + (x / tile);
+		++(t->mismatches);
+		if (diff > t->max_diff) {
+			t->max_diff = diff;
+		}
+	}
+	report->mean_diff = report->mismatches
+	    ? ((1.0 * diff_sum) / report->mismatches) : 0.0;
+	report->mismatch_pct = (100.0 * report->mismatches) / report->pixels;
+	report->passed = (report->mismatch_pct <= options->max_mismatch_pct);
+}
+
+static int validate_compare_tiles(const void *a, const void *b)
+{
+	const validate_tile_s *x = a;
+	const validate_tile_s *y = b;
+	if (x->mismatches != y->mismatches) {
+		return (x->mismatches < y->mismatches) ? 1 : -1;
+	}
+	return (x->max_diff < y->max_diff) - (x->max_diff > y->max_diff);
+}
+
+static void validate_print_header(FILE *out, validate_options_s *options)
+{
+	if (strcmp(options->format, "csv") == 0) {
+		fprintf(out, "engine,scene,width,height,iterations,pixels,"
+			"mismatches,mismatch_pct,escape_flips,max_diff,"
+			"mean_diff,passed,worst_regions\n");
+	} else {
+		fprintf(out, "tolerance: %" PRIu32 " steps, max mismatch:"
+			" %g%%\n", options->tolerance,
+			options->max_mismatch_pct);
+	}
+}
+
+static void validate_print_report(FILE *out, validate_options_s *options,
+				  validate_report_s *r, uint64_t iterations,
+				  validate_tile_s *tiles, size_t tiles_len)
+{
+	size_t worst = options->worst;
+	if (worst > tiles_len) {
+		worst = tiles_len;
+	}
+	qsort(tiles, tiles_len, sizeof(validate_tile_s),
+	      validate_compare_tiles);
+
+	if (strcmp(options->format, "csv") == 0) {
+		fprintf(out, "%s,%s,%" PRIu32 ",%" PRIu32 ",%" PRIu64
+			",%zu,%zu,%.4f,%zu,%" PRIu32 ",%.2f,%d,", r->engine,
+			r->scene->name, r->width, r->height, iterations,
+			r->pixels, r->mismatches, r->mismatch_pct,
+			r->escape_flips, r->max_diff, r->mean_diff, r->passed);
+		/* space separated, so the column stays a single field */
+		for (size_t i = 0; i < worst && tiles[i].mismatches; ++i) {
+			fprintf(out, "%s%" PRIu32 "x%" PRIu32 "+%" PRIu32
+				"+%" PRIu32 ":%zu", i ? " " : "",
+				tiles[i].width, tiles[i].height, tiles[i].x,
+				tiles[i].y, tiles[i].mismatches);
+		}
+		fprintf(out, "\n");
+	} else {
+		fprintf(out, "%-8s %-16s %4" PRIu32 "x%-4" PRIu32
+			" mismatches: %zu (%.4f%%) flips: %zu"
+			" max diff: %" PRIu32 " mean diff: %.2f %s\n",
+			r->engine, r->scene->name, r->width, r->height,
+			r->mismatches, r->mismatch_pct, r->escape_flips,
+			r->max_diff, r->mean_diff, r->passed ? "ok" : "FAIL");
+		for (size_t i = 0; i < worst && tiles[i].mismatches; ++i) {
+			fprintf(out, "\tregion %" PRIu32 "x%" PRIu32 " at %"
+				PRIu32 ",%" PRIu32 ": %zu mismatches,"
+				" max diff %" PRIu32 "\n", tiles[i].width,
+				tiles[i].height, tiles[i].x, tiles[i].y,
+				tiles[i].mismatches, tiles[i].max_diff);
+		}
+	}
+	fflush(out);
+}
+
+static void validate_print_help(FILE *out, const char *argv0)
+{
+	fprintf(out, "%s version %s\n", argv0,
+		VALIDATE_COORD_PLANE_ITERATION_VERSION);
+	fprintf(out, "OPTIONS:\n");
+	fprintf(out, "\t-o --format=s       'text' (default) or 'csv'\n");
+	fprintf(out, "\t-n --scene=s        Only the named scene\n");
+	fprintf(out, "\t-e --engines=s      Comma separated candidates\n");
+	for (size_t i = 0; i < validate_engines_len; ++i) {
+		fprintf(out, "\t                            %s: %s\n",
+			validate_engines[i].name,
+			validate_engines[i].description);
+	}
+	fprintf(out, "\t                            default is all\n");
+	fprintf(out, "\t-z --size=WxH       default is '160x120'\n");
+	fprintf(out, "\t-c --threads=n      For threaded candidates\n");
+	fprintf(out, "\t                            default is '4'\n");
+	fprintf(out, "\t-a --iterations=n   Override each scene's iterations\n");
+	fprintf(out, "\t-k --tolerance=n    Counts this close are equal\n");
+	fprintf(out, "\t                            default is '0'\n");
+	fprintf(out, "\t-m --max_mismatch=n Percent of pixels which may\n");
+	fprintf(out, "\t                            differ, default is '0'\n");
+	fprintf(out, "\t-g --tile=n         Region size, default is '16'\n");
+	fprintf(out, "\t-w --worst=n        Regions to report, default '3'\n");
+	fprintf(out, "\t-V --version        Print version and exit\n");
+	fprintf(out, "\t-H --help           This message and exit\n");
+}
+
+static void validate_options_parse(validate_options_s *options, int argc,
+				   char **argv)
+{
+	options->format = "text";
+	options->scene = NULL;
+	options->engines = NULL;
+	options->width = 160;
+	options->height = 120;
+	options->threads = 4;
+	options->iterations = 0;
+	options->tolerance = 0;
+	options->max_mismatch_pct = 0.0;
+	options->tile = 16;
+	options->worst = 3;
+	options->help = 0;
+	options->version = 0;
+
+	const char *optstring = "HVo:n:e:z:c:a:k:m:g:w:";
+	struct option long_options[] = {
+		{ "help", no_argument, 0, 'H' },
+		{ "version", no_argument, 0, 'V' },
+		{ "format", required_argument, 0, 'o' },
+		{ "scene", required_argument, 0, 'n' },
+		{ "engines", required_argument, 0, 'e' },
+		{ "size", required_argument, 0, 'z' },
+		{ "threads", required_argument, 0, 'c' },
+		{ "iterations", required_argument, 0, 'a' },
+		{ "tolerance", required_argument, 0, 'k' },
+		{ "max_mismatch", required_argument, 0, 'm' },
+		{ "tile", required_argument, 0, 'g' },
+		{ "worst", required_argument, 0, 'w' },
+		{ 0, 0, 0, 0 }
+	};
+
+	char *end = NULL;
+	while (1) {
+		int option_index = 0;
+		int opt_char = getopt_long(argc, argv, optstring, long_options,
+					   &option_index);
+		if (opt_char == -1) {
+			break;
+		}
+		switch (opt_char) {
+		case 'H':
+			options->help = 1;
+			break;
+		case 'V':
+			options->version = 1;
+			break;
+		case 'o':
+			options->format = optarg;
+			break;
+		case 'n':
+			options->scene = optarg;
+			break;
+		case 'e':
+			options->engines = optarg;
+			break;
+		case 'z':
+			options->width = strtoul(optarg, &end, 10);
+			options->height = (*end == 'x' || *end == 'X')
+			    ? strtoul(end + 1, NULL, 10) : 0;
+			break;
+		case 'c':
+			options->threads = strtoul(optarg, NULL, 10);
+			break;
+		case 'a':
+			options->iterations = strtoull(optarg, NULL, 10);
+			break;
+		case 'k':
+			options->tolerance = strtoul(optarg, NULL, 10);
+			break;
+		case 'm':
+			options->max_mismatch_pct = strtod(optarg, NULL);
+			break;
+		case 'g':
+			options->tile = strtoul(optarg, NULL, 10);
+			break;
+		case 'w':
+			options->worst = strtoul(optarg, NULL, 10);
+			break;
+		default:
+			options->help = 1;
+			break;
+		}
+	}
+
+	if (strcmp(options->format, "text") && strcmp(options->format, "csv")) {
+		fprintf(stderr, "unknown --format '%s'\n", options->format);
+		options->help = 1;
+	}
+	if (!options->width || !options->height) {
+		fprintf(stderr, "--size must be WxH\n");
+		options->help = 1;
+	}
+	if (options->scene && !bench_scene_by_name(options->scene)) {
+		fprintf(stderr, "unknown --scene '%s'\n", options->scene);
+		options->help = 1;
+	}
+	options->threads = options->threads ? options->threads : 1;
+	options->tile = options->tile ? options->tile : 16;
+}
+
+int main(int argc, char **argv)
+{
+	signal(SIGSEGV, backtrace_exit_handler);
+
+	validate_options_s options;
+	validate_options_parse(&options, argc, argv);
+	if (options.help) {
+		validate_print_help(stdout, argv[0]);
+		exit(EXIT_SUCCESS);
+	}
+	if (options.version) {
+		fprintf(stdout, "%s\n", VALIDATE_COORD_PLANE_ITERATION_VERSION);
+		exit(EXIT_SUCCESS);
+	}
+
+	size_t pixels = (size_t)options.width * options.height;
+	uint32_t *reference = NULL;
+	alloc_or_die(&reference, sizeof(uint32_t) * pixels);
+	uint32_t *candidate = NULL;
+	alloc_or_die(&candidate, sizeof(uint32_t) * pixels);
+
+	size_t tiles_len = ((options.width + options.tile - 1) / options.tile)
+	    * ((options.height + options.tile - 1) / options.tile);
+	validate_tile_s *tiles = NULL;
+	alloc_or_die(&tiles, sizeof(validate_tile_s) * tiles_len);
+
+	FILE *out = stdout;
+	size_t failures = 0;
+	validate_print_header(out, &options);
+	for (size_t i = 0; i < bench_scenes_len; ++i) {
+		const bench_scene_s *scene = bench_scenes + i;
+		if (options.scene && strcmp(options.scene, scene->name)) {
+			continue;
+		}
+		uint64_t iterations = options.iterations ?
+		    options.iterations : scene->iterations;
+		validate_reference(scene, options.width, options.height,
+				   iterations, 1, reference);
+
+		for (size_t j = 0; j < validate_engines_len; ++j) {
+			const validate_engine_s *engine = validate_engines + j;
+			if (options.engines
+			    && !validate_in_list(options.engines,
+						 engine->name)) {
+				continue;
+			}
+			memset(candidate, 0x00, sizeof(uint32_t) * pixels);
+			if (engine->render(scene, options.width,
+					   options.height, iterations,
+					   options.threads, candidate)) {
+				continue;
+			}
+
+			validate_report_s report;
+			report.engine = engine->name;
+			report.scene = scene;
+			report.width = options.width;
+			report.height = options.height;
+			report.pixels = pixels;
+			validate_compare(reference, candidate, &options,
+					 &report, tiles, tiles_len);
+			validate_print_report(out, &options, &report,
+					      iterations, tiles, tiles_len);
+			if (!report.passed) {
+				++failures;
+			}
+		}
+	}
+
+	free(tiles);
+	free(candidate);
+	free(reference);
+
+	if (failures) {
+		fprintf(stderr, "%zu comparisons over the threshold\n",
+			failures);
+		return 1;
+	}
+	return 0;
+}